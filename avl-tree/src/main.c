@@ -1,12 +1,74 @@
+#include <fcntl.h>
+#include <limits.h>
+#include <pthread.h>
+#include <stdint.h>
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
+#include <sys/stat.h>
+#include <sys/types.h>
+#include <sys/wait.h>
+#include <time.h>
+#include <unistd.h>
+
+#ifdef AVLTREE_AGGREGATE
+/**
+ * Aggregate kept on every node for the values in its subtree when building
+ * with -DAVLTREE_AGGREGATE, allowing range queries in O(log n). Without the
+ * flag, nodes and updates are left untouched.
+ *
+ * To keep a different aggregate, change this type along with
+ * avltree_aggregate_of and avltree_aggregate_combine. The combine operation
+ * must be associative and have avltree_aggregate_identity as its identity.
+ */
+typedef struct {
+    unsigned long long count;
+    long long sum;
+    int min;
+    int max;
+} avltree_aggregate_t;
+
+const avltree_aggregate_t avltree_aggregate_identity = {0, 0, INT_MAX, INT_MIN};
+
+/**
+ * Get the aggregate for a single node.
+ *
+ * @param value the content of the node.
+ * @param count the amount of occurrences of the value in the node.
+ * @return the aggregate for the node.
+ */
+avltree_aggregate_t avltree_aggregate_of(int value, unsigned long long count) {
+    avltree_aggregate_t aggregate = {count, (long long)value * (long long)count, value, value};
+    return aggregate;
+}
+
+/**
+ * Combine the aggregates of two disjoint sets of values.
+ *
+ * @param a the aggregate for the smaller values.
+ * @param b the aggregate for the bigger values.
+ * @return the aggregate for both sets of values.
+ */
+avltree_aggregate_t avltree_aggregate_combine(avltree_aggregate_t a, avltree_aggregate_t b) {
+    avltree_aggregate_t aggregate = {
+        a.count + b.count,
+        a.sum + b.sum,
+        a.min < b.min ? a.min : b.min,
+        a.max > b.max ? a.max : b.max,
+    };
+    return aggregate;
+}
+#endif
 
 typedef struct avltree_s {
     struct avltree_s* left;
     struct avltree_s* right;
     int content;
     unsigned int height;
+    unsigned long long count;
+#ifdef AVLTREE_AGGREGATE
+    avltree_aggregate_t aggregate;
+#endif
 } avltree_t;
 
 /**
@@ -23,6 +85,10 @@ avltree_t* avltree_new_node(int value) {
 
     node->content = value;
     node->height  = 1;
+    node->count   = 1;
+#ifdef AVLTREE_AGGREGATE
+    node->aggregate = avltree_aggregate_of(value, 1);
+#endif
     return node;
 }
 
@@ -63,6 +129,64 @@ avltree_t* avltree_search(avltree_t* node, int value) {
     return avltree_search(node->right, value);
 }
 
+/**
+ * Amount of searches interleaved by avltree_search_batch.
+ */
+#define AVLTREE_BATCH_GROUP 16
+
+/**
+ * Search for many values in a tree at once. Results are the same as calling
+ * avltree_search for each value.
+ *
+ * Instead of walking the tree for one value at a time, a group of searches is
+ * advanced one level at a time in a round robin fashion. Every time a search
+ * moves to a child node, the node is prefetched, so by the time the search gets
+ * its turn again the node is likely in cache. This way the cache misses of the
+ * searches in the group overlap instead of leaving the CPU waiting on each one.
+ *
+ * @param tree a pointer to the root of the tree.
+ * @param values the integers to look for in the tree.
+ * @param values_size the amount of values.
+ * @param results where to store a pointer to the node holding each value, NULL if not found.
+ */
+void avltree_search_batch(avltree_t* tree, const int values[], size_t values_size, avltree_t* results[]) {
+    avltree_t* nodes[AVLTREE_BATCH_GROUP];
+    size_t indexes[AVLTREE_BATCH_GROUP];
+    size_t active = 0;
+    size_t next   = 0;
+
+    for (int i = 0; i < AVLTREE_BATCH_GROUP; i++) {
+        nodes[i]   = tree;
+        indexes[i] = next < values_size ? next++ : values_size;
+        active    += indexes[i] < values_size;
+    }
+
+    while (active > 0) {
+        for (int i = 0; i < AVLTREE_BATCH_GROUP; i++) {
+            if (indexes[i] == values_size) {
+                // Nothing left for this slot.
+                continue;
+            }
+
+            avltree_t* node = nodes[i];
+            int value       = values[indexes[i]];
+            if (node == NULL || node->content == value) {
+                results[indexes[i]] = node;
+
+                // Start the next search on this slot.
+                nodes[i]   = tree;
+                indexes[i] = next < values_size ? next++ : values_size;
+                active    -= indexes[i] == values_size;
+                continue;
+            }
+
+            node = node->content > value ? node->left : node->right;
+            __builtin_prefetch(node);
+            nodes[i] = node;
+        }
+    }
+}
+
 /**
  * Get the balance factor for the current node.
  *
@@ -80,8 +204,9 @@ int avltree_get_balance_factor(avltree_t* node) {
 }
 
 /**
- * Get the height for a node by recursively calculating the height of child
- * nodes.
+ * Get the height for a node from the heights stored in its child nodes, so
+ * those need to be up to date. Updating the nodes from the bottom up keeps this
+ * O(1) instead of walking the whole subtree.
  *
  * @param node a pointer to the node we are trying to get the height from.
  * @return the height for the provided node.
@@ -91,10 +216,31 @@ unsigned int avltree_get_height(avltree_t* node) {
         return 0;
     }
 
-    unsigned int right_depth = 1 + avltree_get_height(node->right);
-    unsigned int left_depth  = 1 + avltree_get_height(node->left);
+    unsigned int right_height = node->right ? node->right->height : 0;
+    unsigned int left_height  = node->left ? node->left->height : 0;
+
+    return 1 + (right_height > left_height ? right_height : left_height);
+}
 
-    return right_depth > left_depth ? right_depth : left_depth;
+/**
+ * Refresh the information a node keeps about its subtree: its height and,
+ * when built with AVLTREE_AGGREGATE, its aggregate. Child nodes need to be up
+ * to date.
+ *
+ * @param node a pointer to the node to be updated.
+ */
+void avltree_update(avltree_t* node) {
+    node->height = avltree_get_height(node);
+#ifdef AVLTREE_AGGREGATE
+    avltree_aggregate_t aggregate = avltree_aggregate_of(node->content, node->count);
+    if (node->left != NULL) {
+        aggregate = avltree_aggregate_combine(node->left->aggregate, aggregate);
+    }
+    if (node->right != NULL) {
+        aggregate = avltree_aggregate_combine(aggregate, node->right->aggregate);
+    }
+    node->aggregate = aggregate;
+#endif
 }
 
 typedef enum {
@@ -126,8 +272,9 @@ avltree_t* avltree_rotate(avltree_t* node, avltree_rotation_t rotate) {
         node->left      = tmp;
     }
 
-    new_node->height = avltree_get_height(new_node);
-    node->height     = avltree_get_height(node);
+    // The old node is now a child of the new one, so it goes first.
+    avltree_update(node);
+    avltree_update(new_node);
 
     return new_node;
 }
@@ -212,7 +359,7 @@ avltree_t* avltree_insert_inner(avltree_t* node, avltree_t* parent, int value) {
         }
     }
 
-    node->height = avltree_get_height(node);
+    avltree_update(node);
 
     return avltree_balance(node, parent);
 }
@@ -243,9 +390,13 @@ typedef enum {
  * This function is used as part of the process for deleting a node, the deleted
  * node will be replaced by the popped leaf. In order to reach the leaf, we can
  * tell the function to look for the leaf on the lower or higher values with the
- * bias argument. By popped leaf, we refer to a node on the lowest level of the
- * tree that is removed from the tree for the caller to use without the
- * possibility of the node to be pointed by multiple points in the tree.
+ * bias argument. By popped leaf, we refer to the smallest or biggest node under
+ * the provided node, which has at most one child. That child takes its place so
+ * the caller can use the popped node without the possibility of the node to be
+ * pointed by multiple points in the tree.
+ *
+ * If the provided node is itself the smallest or biggest one, it is returned
+ * as is and it is up to the caller to unlink it from its parent.
  *
  * @param node a pointer to a avltree_t node where we will look for a leaf
  * @param bias a bias parameter for us to choose which branch should be preferred.
@@ -260,10 +411,10 @@ avltree_t* avltree_pop_leaf(avltree_t* node, avltree_pop_bias_t bias) {
 
     switch (bias) {
     case SMALLEST:
-        leaf = node->left != NULL ? node->left : node->right;
+        leaf = node->left;
         break;
     case BIGGEST:
-        leaf = node->right != NULL ? node->right : node->left;
+        leaf = node->right;
         break;
     default:
         printf("Programmer logic error, invalid avltree pop bias\n");
@@ -271,53 +422,53 @@ avltree_t* avltree_pop_leaf(avltree_t* node, avltree_pop_bias_t bias) {
     }
 
     if (leaf == NULL) {
-        // The node itself was a leaf.
-        leaf = node;
-        goto end;
-    }
-
-    if (leaf->left != NULL || leaf->right != NULL) {
-        // The leaf is not actually a leaf, we need to go deeper.
-        avltree_t* retval = avltree_pop_leaf(leaf, bias);
-        leaf->height      = avltree_get_height(leaf);
-        return retval;
+        // The node itself is the one we are looking for.
+        return node;
     }
 
-end:
-    // We found the leaf, pop it from the tree and return it.
-    if (node->right == leaf) {
-        node->right = NULL;
+    avltree_t* retval = avltree_pop_leaf(leaf, bias);
+    if (retval == leaf) {
+        // We found the leaf, pop it from the tree and return it.
+        if (bias == SMALLEST) {
+            node->left = leaf->right;
+        } else {
+            node->right = leaf->left;
+        }
+        leaf->left = leaf->right = NULL;
     } else {
-        node->left = NULL;
+        avltree_balance(leaf, node);
     }
-    return leaf;
+
+    avltree_update(node);
+    return retval;
 }
 
 /**
- * Replace a node from a tree with a leaf.
+ * Unlink a node from a tree, replacing it with a leaf.
  *
- * This function is used as part of the delete node process. The provided node
- * will be replaced by a popped leaf, keeping the tree balanced.
+ * This is an inner function, it does all of avltree_replace_node except for
+ * freeing the node, which is left to the caller.
  *
  * @param node a pointer to the avltree_t node to be replaced by a leaf.
  * @param parent a pointer to the parent of the provided node.
  * @return a pointer to the new node in the tree.
  */
-avltree_t* avltree_replace_node(avltree_t* node, avltree_t* parent) {
+avltree_t* avltree_unlink_node(avltree_t* node, avltree_t* parent) {
     if (node == NULL) {
         return NULL;
     }
 
     avltree_t* replacement_node;
-    if (node->left != NULL) {
-        replacement_node = avltree_pop_leaf(node->left, BIGGEST);
+    if (node->left == NULL) {
+        // Nothing smaller than the node, its right branch can take its place.
+        replacement_node = node->right;
     } else {
-        replacement_node = avltree_pop_leaf(node->right, SMALLEST);
-    }
-
-    if (replacement_node != NULL) {
-        replacement_node->left  = node->left != replacement_node ? node->left : NULL;
-        replacement_node->right = node->right != replacement_node ? node->right : NULL;
+        replacement_node = avltree_pop_leaf(node->left, BIGGEST);
+        if (replacement_node != node->left) {
+            replacement_node->left = node->left;
+            avltree_balance(node->left, replacement_node);
+        }
+        replacement_node->right = node->right;
     }
 
     if (parent) {
@@ -328,8 +479,24 @@ avltree_t* avltree_replace_node(avltree_t* node, avltree_t* parent) {
         }
     }
 
-    // Free the memory for the node
     node->right = node->left = NULL;
+    return replacement_node;
+}
+
+/**
+ * Replace a node from a tree with a leaf.
+ *
+ * This function is used as part of the delete node process. The provided node
+ * will be replaced by a popped leaf, keeping the tree balanced.
+ *
+ * @param node a pointer to the avltree_t node to be replaced by a leaf.
+ * @param parent a pointer to the parent of the provided node.
+ * @return a pointer to the new node in the tree.
+ */
+avltree_t* avltree_replace_node(avltree_t* node, avltree_t* parent) {
+    avltree_t* replacement_node = avltree_unlink_node(node, parent);
+
+    // Free the memory for the node
     avltree_free(node);
 
     return replacement_node;
@@ -368,7 +535,7 @@ avltree_t* avltree_delete_inner(avltree_t* node, avltree_t* parent, int value) {
         return NULL;
     }
 
-    node->height = avltree_get_height(node);
+    avltree_update(node);
 
     avltree_t* new_node = avltree_balance(node, parent);
 
@@ -385,120 +552,2649 @@ avltree_t* avltree_delete_inner(avltree_t* node, avltree_t* parent, int value) {
  */
 #define avltree_delete(tree, value) avltree_delete_inner(tree, NULL, value)
 
+#ifdef AVLTREE_AGGREGATE
 /**
- * Print a formatted node of a tree. This is an inner function and you should
- * use avltree_print instead.
+ * Refresh the aggregates of the nodes on the path from the root of a tree to
+ * the node holding the provided value, used when a node changes without
+ * changing the shape of the tree.
  *
- * @param tree a pointer to the current node to print.
- * @param pointy a string with the arrow that should be printed next to the node.
- * @param padding a string with the padding needed for the tree to look nice.
+ * @param node a pointer to the current node on the path.
+ * @param value the integer held by the node that changed.
  */
-void avltree_print_inner(const avltree_t* tree, const char* pointy, char padding[1024]) {
-    if (tree == NULL) {
+void avltree_update_path(avltree_t* node, int value) {
+    if (node == NULL) {
         return;
     }
 
-    printf("%s%d\n", pointy, tree->content);
+    if (node->content > value) {
+        avltree_update_path(node->left, value);
+    } else if (node->content < value) {
+        avltree_update_path(node->right, value);
+    }
+    avltree_update(node);
+}
+#endif
 
-    if (tree->left == NULL && tree->right == NULL) {
-        return;
+/**
+ * Inner function used for inserting values into a tree used as a multiset,
+ * also telling the caller whether the value was counted, which only fails if
+ * a new node is needed and we fail to allocate it.
+ * This is not meant to be used directly, you should use avltree_insert_multi instead.
+ *
+ * The tree is walked down once, keeping the path in a stack. If a node is
+ * added, the path is walked back up refreshing and rebalancing every node in
+ * it, otherwise it is only walked back up to refresh the aggregates.
+ *
+ * @param tree a pointer to the root of the tree the value will be inserted into.
+ * @param value an integer to be inserted in the tree.
+ * @param counted set to 1 if a node was added or a count incremented for the value, 0 otherwise.
+ * @return a pointer to the root of the tree.
+ */
+avltree_t* avltree_insert_multi_inner(avltree_t* tree, int value, int* counted) {
+    *counted = 0;
+    if (tree == NULL) {
+        return NULL;
     }
 
-    if (tree->left) {
-        printf("%s", padding);
-        strcat(padding, "|   ");
-        avltree_print_inner(tree->left, "|-> ", padding);
-        padding[strlen(padding) - 4] = '\0';
-    } else {
-        printf("%s%s\n", padding, "|-> ");
+    // An AVL tree holding every possible int is less than 64 nodes high.
+    avltree_t* path[64];
+    size_t depth    = 0;
+    avltree_t* node = tree;
+    while (node != NULL && node->content != value) {
+        path[depth++] = node;
+        node          = node->content > value ? node->left : node->right;
     }
 
-    if (tree->right) {
-        printf("%s", padding);
-        strcat(padding, "    ");
-        avltree_print_inner(tree->right, "┗-> ", padding);
-        padding[strlen(padding) - 4] = '\0';
+    if (node != NULL) {
+        node->count++;
+        *counted = 1;
+#ifdef AVLTREE_AGGREGATE
+        avltree_update(node);
+        for (size_t i = depth; i-- > 0;) {
+            avltree_update(path[i]);
+        }
+#endif
+        return tree;
+    }
+
+    node = avltree_new_node(value);
+    if (node == NULL) {
+        return tree;
+    }
+    *counted = 1;
+
+    avltree_t* parent = path[depth - 1];
+    if (parent->content > value) {
+        parent->left = node;
     } else {
-        printf("%s%s\n", padding, "┗-> ");
+        parent->right = node;
+    }
+
+    for (size_t i = depth; i-- > 0;) {
+        avltree_update(path[i]);
+        node = avltree_balance(path[i], i > 0 ? path[i - 1] : NULL);
     }
+    return node;
 }
 
 /**
- * Print a tree in a nice way.
+ * Insert a value into a tree used as a multiset. If the value is already in the
+ * tree, its occurrence count is incremented instead of adding a new node, so
+ * memory scales with the amount of distinct values rather than insertions.
  *
- * @param tree a pointer to the tree to be printed.
+ * @param tree a pointer to the root of the tree the value will be inserted into.
+ * @param value an integer to be inserted in the tree.
+ * @return a pointer to the root of the tree.
  */
-void avltree_print(const avltree_t* tree) {
-    char padding[1024] = {0};
-    if (tree == NULL) {
-        return;
+avltree_t* avltree_insert_multi(avltree_t* tree, int value) {
+    int counted;
+    return avltree_insert_multi_inner(tree, value, &counted);
+}
+
+/**
+ * Remove one occurrence of a value from a tree used as a multiset. The node
+ * holding the value is only removed from the tree once its count reaches 0.
+ *
+ * @param tree a pointer to the root of the tree to look for the value.
+ * @param value an integer we are looking for in the tree.
+ * @return a pointer to the root of the tree, needed if the root is the node to be removed.
+ */
+avltree_t* avltree_delete_multi(avltree_t* tree, int value) {
+    avltree_t* node = avltree_search(tree, value);
+    if (node == NULL) {
+        return tree;
     }
 
-    avltree_print_inner(tree, "", padding);
+    if (node->count > 1) {
+        node->count--;
+#ifdef AVLTREE_AGGREGATE
+        avltree_update_path(tree, value);
+#endif
+        return tree;
+    }
+
+    return avltree_delete(tree, value);
 }
 
-int main() {
-    printf("============================= Starting up ======================================\n");
+/**
+ * Get the amount of times a value is present in a tree used as a multiset.
+ *
+ * @param tree a pointer to the root of the tree to look for the value.
+ * @param value an integer we are looking for in the tree.
+ * @return the occurrence count for the value, 0 if it is not in the tree.
+ */
+unsigned long long avltree_count(avltree_t* tree, int value) {
+    avltree_t* node = avltree_search(tree, value);
+    return node != NULL ? node->count : 0;
+}
 
-    avltree_t* root = avltree_new_node(10);
-    root            = avltree_insert(root, 5);
-    root            = avltree_insert(root, 15);
-    root            = avltree_insert(root, 3);
-    root            = avltree_insert(root, 8);
-    root            = avltree_insert(root, 20);
+#ifdef AVLTREE_AGGREGATE
+/**
+ * Get the aggregate of a whole subtree.
+ *
+ * @param node a pointer to the root of the subtree.
+ * @return the aggregate for the subtree, the identity if it is empty.
+ */
+avltree_aggregate_t avltree_aggregate(const avltree_t* node) {
+    return node != NULL ? node->aggregate : avltree_aggregate_identity;
+}
 
-    printf("Base tree:\n");
-    avltree_print(root);
-    printf("================================================================================\n");
+/**
+ * This is an inner function, it aggregates the values in a subtree that are
+ * not less than lower. Only the path to lower is walked, the subtrees hanging
+ * to the right of it are taken as a whole.
+ *
+ * @param node a pointer to the root of the subtree.
+ * @param lower the smallest value to include.
+ * @return the aggregate for the values in the subtree not less than lower.
+ */
+avltree_aggregate_t avltree_aggregate_from(const avltree_t* node, int lower) {
+    if (node == NULL) {
+        return avltree_aggregate_identity;
+    }
 
-    printf("Insert node with value 24:\n");
-    root = avltree_insert(root, 24);
+    if (node->content < lower) {
+        return avltree_aggregate_from(node->right, lower);
+    }
 
-    avltree_print(root);
-    printf("================================================================================\n");
+    avltree_aggregate_t left = avltree_aggregate_from(node->left, lower);
+    avltree_aggregate_t self = avltree_aggregate_of(node->content, node->count);
+    return avltree_aggregate_combine(avltree_aggregate_combine(left, self), avltree_aggregate(node->right));
+}
 
-    printf("Delete node with value 20:\n");
-    root = avltree_delete(root, 20);
+/**
+ * This is an inner function, it aggregates the values in a subtree that are
+ * not greater than upper. Mirror of avltree_aggregate_from.
+ *
+ * @param node a pointer to the root of the subtree.
+ * @param upper the biggest value to include.
+ * @return the aggregate for the values in the subtree not greater than upper.
+ */
+avltree_aggregate_t avltree_aggregate_to(const avltree_t* node, int upper) {
+    if (node == NULL) {
+        return avltree_aggregate_identity;
+    }
 
-    avltree_print(root);
-    printf("================================================================================\n");
+    if (node->content > upper) {
+        return avltree_aggregate_to(node->left, upper);
+    }
 
-    printf("Search for an existing element:\n");
-    avltree_print(avltree_search(root, 5));
-    printf("================================================================================\n");
+    avltree_aggregate_t self  = avltree_aggregate_of(node->content, node->count);
+    avltree_aggregate_t right = avltree_aggregate_to(node->right, upper);
+    return avltree_aggregate_combine(avltree_aggregate(node->left), avltree_aggregate_combine(self, right));
+}
 
-    printf("Search for an element that has been deleted:\n");
-    avltree_print(avltree_search(root, 20));
-    printf("================================================================================\n");
+/**
+ * Aggregate all values in a tree within [lower, upper]. Only the paths to both
+ * bounds are walked, so this takes O(log n) regardless of the range width.
+ *
+ * @param tree a pointer to the root of the tree.
+ * @param lower the smallest value to include.
+ * @param upper the biggest value to include.
+ * @return the aggregate for the values in the range, the identity if there are none.
+ */
+avltree_aggregate_t avltree_range_aggregate(const avltree_t* tree, int lower, int upper) {
+    // Look for the node where the paths to both bounds split.
+    while (tree != NULL && (tree->content < lower || tree->content > upper)) {
+        tree = tree->content < lower ? tree->right : tree->left;
+    }
 
-    printf("Balance factor for node 10: %u\n", avltree_get_balance_factor(avltree_search(root, 10)));
-    printf("================================================================================\n");
+    if (tree == NULL) {
+        return avltree_aggregate_identity;
+    }
 
-    printf("Height of the tree: %u\n", root->height);
-    printf("================================================================================\n");
+    avltree_aggregate_t left  = avltree_aggregate_from(tree->left, lower);
+    avltree_aggregate_t self  = avltree_aggregate_of(tree->content, tree->count);
+    avltree_aggregate_t right = avltree_aggregate_to(tree->right, upper);
+    return avltree_aggregate_combine(avltree_aggregate_combine(left, self), right);
+}
+#endif
 
-    printf("Insert node 6 and 7 to force a LR rotation: \n");
-    root = avltree_insert(root, 6);
-    root = avltree_insert(root, 7);
-    avltree_print(root);
-    printf("================================================================================\n");
+/**
+ * Create a perfectly balanced tree holding the provided values. This is the
+ * fast path for loading many values at once, taking O(n) instead of inserting
+ * them one at a time.
+ *
+ * @param values a sorted array of integers, without duplicates.
+ * @param size the amount of values.
+ * @return a pointer to the root of the new tree, NULL if there are no values.
+ */
+avltree_t* avltree_from_sorted(const int values[], size_t size) {
+    if (size == 0) {
+        return NULL;
+    }
 
-    printf("Insert node 23 to force a RL rotation: \n");
-    root = avltree_insert(root, 23);
-    avltree_print(root);
-    printf("================================================================================\n");
+    size_t middle   = size / 2;
+    avltree_t* node = avltree_new_node(values[middle]);
+    if (node == NULL) {
+        return NULL;
+    }
 
-    printf("Remove the root of the tree for testing:\n");
-    root = avltree_delete(root, 10);
+    node->left  = avltree_from_sorted(values, middle);
+    node->right = avltree_from_sorted(values + middle + 1, size - middle - 1);
+    avltree_update(node);
+    return node;
+}
 
-    avltree_print(root);
-    printf("================================================================================\n");
+/**
+ * Operations recorded in a journal. Each record is the operation as a single
+ * byte followed by the value, as an int in native byte order.
+ */
+#define AVLTREE_JOURNAL_INSERT 'I'
+#define AVLTREE_JOURNAL_DELETE 'D'
+#define AVLTREE_JOURNAL_RECORD_SIZE (1 + sizeof(int))
 
-    printf("Remove a leaf of the tree for testing:\n");
-    root = avltree_delete(root, 3);
+/**
+ * A write-ahead journal for the changes done to a tree.
+ *
+ * For a journal at path, the files used are:
+ *   path.journal: records for the changes since the last compaction.
+ *   path.journal.old: records being compacted, only present during a compaction.
+ *   path.snapshot: the values in the tree at the last compaction, sorted.
+ */
+typedef struct {
+    char* path;
+    FILE* file;
+    unsigned int commit_interval;
+    unsigned int pending;
+    pid_t compaction;
+} avltree_journal_t;
 
-    avltree_print(root);
+/**
+ * Get the path for one of the files of a journal.
+ *
+ * @param path the path the journal was opened with.
+ * @param suffix the suffix for the file.
+ * @return a newly allocated string with the path, NULL if we fail to allocate memory.
+ */
+char* avltree_journal_path(const char* path, const char* suffix) {
+    char* full_path = malloc(strlen(path) + strlen(suffix) + 1);
+    if (full_path == NULL) {
+        return NULL;
+    }
+
+    strcpy(full_path, path);
+    strcat(full_path, suffix);
+    return full_path;
+}
+
+/**
+ * This is an inner function, it drops a record cut short by a crash at the end
+ * of a journal file, so the records appended after it stay aligned.
+ *
+ * @param file the journal file, opened for appending.
+ * @return 0 on success, -1 otherwise.
+ */
+int avltree_journal_trim(FILE* file) {
+    struct stat info;
+    if (fstat(fileno(file), &info) != 0) {
+        return -1;
+    }
+
+    off_t torn = info.st_size % AVLTREE_JOURNAL_RECORD_SIZE;
+    return torn == 0 ? 0 : ftruncate(fileno(file), info.st_size - torn);
+}
+
+/**
+ * Open a journal for appending records, creating it if needed.
+ *
+ * Records are written to disk in groups: the journal is only synced once every
+ * commit_interval records, trading the amount of changes that can be lost on a
+ * crash for throughput.
+ *
+ * @param path the base path for the journal files.
+ * @param commit_interval the amount of records per sync, 0 to only sync on commit and close.
+ * @return a pointer to the journal, NULL if it could not be opened.
+ */
+avltree_journal_t* avltree_journal_open(const char* path, unsigned int commit_interval) {
+    avltree_journal_t* journal = calloc(1, sizeof(avltree_journal_t));
+    if (journal == NULL) {
+        return NULL;
+    }
+
+    journal->path            = strdup(path);
+    journal->commit_interval = commit_interval;
+
+    char* journal_path = journal->path != NULL ? avltree_journal_path(path, ".journal") : NULL;
+    if (journal_path != NULL) {
+        journal->file = fopen(journal_path, "ab");
+    }
+    free(journal_path);
+
+    if (journal->file != NULL && avltree_journal_trim(journal->file) != 0) {
+        fclose(journal->file);
+        journal->file = NULL;
+    }
+    if (journal->file == NULL) {
+        printf("Failed to open journal at %s\n", path);
+        free(journal->path);
+        free(journal);
+        return NULL;
+    }
+
+    return journal;
+}
+
+/**
+ * Sync all pending records of a journal to disk.
+ *
+ * @param journal a pointer to the journal.
+ * @return 0 on success, -1 otherwise.
+ */
+int avltree_journal_commit(avltree_journal_t* journal) {
+    if (journal->pending == 0) {
+        return 0;
+    }
+
+    if (fflush(journal->file) != 0 || fsync(fileno(journal->file)) != 0) {
+        return -1;
+    }
+
+    journal->pending = 0;
+    return 0;
+}
+
+/**
+ * Append a record to a journal, syncing it to disk if the commit interval is
+ * reached.
+ *
+ * @param journal a pointer to the journal.
+ * @param operation the operation being recorded.
+ * @param value the value the operation is done with.
+ * @return 0 on success, -1 otherwise.
+ */
+int avltree_journal_append(avltree_journal_t* journal, char operation, int value) {
+    if (fwrite(&operation, 1, 1, journal->file) != 1 || fwrite(&value, sizeof(int), 1, journal->file) != 1) {
+        return -1;
+    }
+
+    journal->pending++;
+    if (journal->commit_interval != 0 && journal->pending >= journal->commit_interval) {
+        return avltree_journal_commit(journal);
+    }
+    return 0;
+}
+
+/**
+ * Insert a value into a tree, recording it in a journal first.
+ *
+ * @param journal a pointer to the journal, NULL to skip journaling.
+ * @param tree a pointer to the root of the tree, NULL for an empty tree.
+ * @param value an integer to be used as the content for a new node.
+ * @return a pointer to the root of the tree.
+ */
+avltree_t* avltree_journal_insert(avltree_journal_t* journal, avltree_t* tree, int value) {
+    if (journal != NULL && avltree_journal_append(journal, AVLTREE_JOURNAL_INSERT, value) != 0) {
+        printf("Failed to write to the journal, %d was not inserted\n", value);
+        return tree;
+    }
+
+    return tree == NULL ? avltree_new_node(value) : avltree_insert(tree, value);
+}
+
+/**
+ * Delete a value from a tree, recording it in a journal first.
+ *
+ * @param journal a pointer to the journal, NULL to skip journaling.
+ * @param tree a pointer to the root of the tree.
+ * @param value an integer we are looking for in the tree.
+ * @return a pointer to the root of the tree, needed if the root is the node to be removed.
+ */
+avltree_t* avltree_journal_delete(avltree_journal_t* journal, avltree_t* tree, int value) {
+    if (journal != NULL && avltree_journal_append(journal, AVLTREE_JOURNAL_DELETE, value) != 0) {
+        printf("Failed to write to the journal, %d was not deleted\n", value);
+        return tree;
+    }
+
+    return avltree_delete(tree, value);
+}
+
+/**
+ * This is an inner function, it writes the values of a tree in order.
+ *
+ * @param tree a pointer to the current node.
+ * @param file the file to write to.
+ * @return 0 on success, -1 otherwise.
+ */
+int avltree_journal_write_values(const avltree_t* tree, FILE* file) {
+    if (tree == NULL) {
+        return 0;
+    }
+
+    if (avltree_journal_write_values(tree->left, file) != 0 || fwrite(&tree->content, sizeof(int), 1, file) != 1) {
+        return -1;
+    }
+    return avltree_journal_write_values(tree->right, file);
+}
+
+/**
+ * This is an inner function, it syncs the directory holding a file to disk so
+ * a rename into it survives a crash.
+ *
+ * @param path the path of the file.
+ * @return 0 on success, -1 otherwise.
+ */
+int avltree_journal_sync_directory(const char* path) {
+    const char* slash = strrchr(path, '/');
+    char* directory   = slash == NULL ? strdup(".") : strndup(path, slash == path ? 1 : slash - path);
+    int fd            = directory != NULL ? open(directory, O_RDONLY | O_DIRECTORY) : -1;
+    free(directory);
+    if (fd < 0) {
+        return -1;
+    }
+
+    int result = fsync(fd);
+    close(fd);
+    return result;
+}
+
+/**
+ * Write a snapshot of a tree and drop the records it makes redundant. The
+ * snapshot is written to a temporary file and renamed once it is on disk, so
+ * a crash leaves either the previous snapshot or the new one. The records are
+ * only dropped once the rename itself is on disk.
+ *
+ * @param path the base path for the journal files.
+ * @param tree a pointer to the root of the tree.
+ * @return 0 on success, -1 otherwise.
+ */
+int avltree_journal_write_snapshot(const char* path, const avltree_t* tree) {
+    char* tmp_path      = avltree_journal_path(path, ".snapshot.tmp");
+    char* snapshot_path = avltree_journal_path(path, ".snapshot");
+    char* old_path      = avltree_journal_path(path, ".journal.old");
+    int result          = -1;
+
+    FILE* file = tmp_path != NULL ? fopen(tmp_path, "wb") : NULL;
+    if (file != NULL) {
+        result = avltree_journal_write_values(tree, file);
+        if (fflush(file) != 0 || fsync(fileno(file)) != 0) {
+            result = -1;
+        }
+        fclose(file);
+    }
+
+    if (result == 0 && snapshot_path != NULL && old_path != NULL && rename(tmp_path, snapshot_path) == 0 &&
+        avltree_journal_sync_directory(snapshot_path) == 0) {
+        unlink(old_path);
+    } else {
+        result = -1;
+    }
+
+    free(tmp_path);
+    free(snapshot_path);
+    free(old_path);
+    return result;
+}
+
+/**
+ * Wait for the compaction of a journal to be done, if there is one running.
+ *
+ * @param journal a pointer to the journal.
+ * @return 0 if the compaction succeeded or there was none, -1 otherwise.
+ */
+int avltree_journal_wait(avltree_journal_t* journal) {
+    if (journal->compaction <= 0) {
+        return 0;
+    }
+
+    int status = 0;
+    waitpid(journal->compaction, &status, 0);
+    journal->compaction = 0;
+    return WIFEXITED(status) && WEXITSTATUS(status) == 0 ? 0 : -1;
+}
+
+/**
+ * This is an inner function, it moves the records in the journal file to the
+ * file with the records being compacted. If a previous compaction failed, the
+ * records are appended to the ones it left behind so none of them are lost,
+ * after dropping a record cut short at their end.
+ *
+ * @param journal_path the path of the journal file.
+ * @param old_path the path of the file with the records being compacted.
+ * @return 0 on success, -1 otherwise.
+ */
+int avltree_journal_rotate(const char* journal_path, const char* old_path) {
+    if (access(old_path, F_OK) != 0) {
+        return rename(journal_path, old_path);
+    }
+
+    FILE* from = fopen(journal_path, "rb");
+    FILE* to   = fopen(old_path, "ab");
+    int result = from != NULL && to != NULL && avltree_journal_trim(to) == 0 ? 0 : -1;
+
+    char buffer[4096];
+    size_t read;
+    while (result == 0 && (read = fread(buffer, 1, sizeof(buffer), from)) > 0) {
+        result = fwrite(buffer, 1, read, to) == read ? 0 : -1;
+    }
+
+    if (to != NULL && (fflush(to) != 0 || fsync(fileno(to)) != 0)) {
+        result = -1;
+    }
+    if (from != NULL) {
+        fclose(from);
+    }
+    if (to != NULL) {
+        fclose(to);
+    }
+    return result == 0 ? unlink(journal_path) : -1;
+}
+
+/**
+ * Compact a journal into a sorted snapshot of the tree, in the background.
+ *
+ * The current records are set aside and a new journal is started, then a
+ * child process writes the snapshot from its copy of the tree while the caller
+ * keeps working on the tree. Only one compaction runs at a time, starting a
+ * new one waits for the previous one to be done.
+ *
+ * @param journal a pointer to the journal.
+ * @param tree a pointer to the root of the tree the journal is recording.
+ * @return 0 if the compaction was started, -1 otherwise.
+ */
+int avltree_journal_compact(avltree_journal_t* journal, const avltree_t* tree) {
+    avltree_journal_wait(journal);
+
+    if (avltree_journal_commit(journal) != 0) {
+        return -1;
+    }
+
+    char* journal_path = avltree_journal_path(journal->path, ".journal");
+    char* old_path     = avltree_journal_path(journal->path, ".journal.old");
+    int result         = -1;
+    if (journal_path != NULL && old_path != NULL) {
+        fclose(journal->file);
+        result        = avltree_journal_rotate(journal_path, old_path);
+        journal->file = fopen(journal_path, "ab");
+    }
+    free(journal_path);
+    free(old_path);
+
+    if (journal->file == NULL) {
+        printf("Failed to reopen journal at %s\n", journal->path);
+        return -1;
+    }
+    if (result != 0) {
+        return -1;
+    }
+
+    fflush(stdout);
+    pid_t pid = fork();
+    if (pid == 0) {
+        _exit(avltree_journal_write_snapshot(journal->path, tree) == 0 ? 0 : 1);
+    } else if (pid < 0) {
+        // No child to do it in the background, do it ourselves.
+        return avltree_journal_write_snapshot(journal->path, tree);
+    }
+
+    journal->compaction = pid;
+    return 0;
+}
+
+/**
+ * Close a journal, syncing any pending records and waiting for a running
+ * compaction to be done.
+ *
+ * @param journal a pointer to the journal.
+ */
+void avltree_journal_close(avltree_journal_t* journal) {
+    if (journal == NULL) {
+        return;
+    }
+
+    avltree_journal_commit(journal);
+    avltree_journal_wait(journal);
+    fclose(journal->file);
+    free(journal->path);
+    free(journal);
+}
+
+/**
+ * Remove all the files of a journal.
+ *
+ * @param path the base path for the journal files.
+ */
+void avltree_journal_remove(const char* path) {
+    const char* suffixes[] = {".journal", ".journal.old", ".snapshot", ".snapshot.tmp"};
+    for (size_t i = 0; i < sizeof(suffixes) / sizeof(suffixes[0]); i++) {
+        char* file_path = avltree_journal_path(path, suffixes[i]);
+        if (file_path != NULL) {
+            unlink(file_path);
+        }
+        free(file_path);
+    }
+}
+
+/**
+ * This is an inner function, it appends the contents of a file to a buffer.
+ *
+ * @param path the path of the file to read, a missing file is read as empty.
+ * @param buffer a pointer to the buffer, reallocated to fit the file.
+ * @param size a pointer to the size of the buffer, updated after reading.
+ * @return 0 on success, -1 otherwise.
+ */
+int avltree_journal_read(const char* path, char** buffer, size_t* size) {
+    FILE* file = path != NULL ? fopen(path, "rb") : NULL;
+    if (file == NULL) {
+        return path != NULL ? 0 : -1;
+    }
+
+    int result = 0;
+    char chunk[4096];
+    size_t read;
+    while ((read = fread(chunk, 1, sizeof(chunk), file)) > 0) {
+        char* grown = realloc(*buffer, *size + read);
+        if (grown == NULL) {
+            result = -1;
+            break;
+        }
+
+        memcpy(grown + *size, chunk, read);
+        *buffer = grown;
+        *size += read;
+    }
+
+    fclose(file);
+    return result;
+}
+
+typedef struct {
+    int value;
+    char operation;
+    size_t sequence;
+} avltree_journal_record_t;
+
+/**
+ * Compare two journal records by value and then by the order they were
+ * written in, to be used with qsort.
+ */
+int avltree_journal_compare_records(const void* a, const void* b) {
+    const avltree_journal_record_t* x = a;
+    const avltree_journal_record_t* y = b;
+    if (x->value != y->value) {
+        return x->value < y->value ? -1 : 1;
+    }
+    return (x->sequence > y->sequence) - (x->sequence < y->sequence);
+}
+
+/**
+ * This is an inner function, it parses the records of a journal file, ignoring
+ * a record cut short by a crash at its end.
+ *
+ * @param log the contents of the journal file.
+ * @param log_size the size of the contents.
+ * @param records the array to append the records to, numbered after the ones already in it.
+ * @param records_size a pointer to the amount of records in the array, updated after parsing.
+ */
+void avltree_journal_parse(const char* log, size_t log_size, avltree_journal_record_t* records, size_t* records_size) {
+    for (size_t i = 0; i < log_size / AVLTREE_JOURNAL_RECORD_SIZE; i++) {
+        avltree_journal_record_t* record = &records[(*records_size)++];
+        record->operation                = log[i * AVLTREE_JOURNAL_RECORD_SIZE];
+        record->sequence                 = *records_size;
+        memcpy(&record->value, log + i * AVLTREE_JOURNAL_RECORD_SIZE + 1, sizeof(int));
+    }
+}
+
+/**
+ * Rebuild a tree from the files of a journal.
+ *
+ * Instead of replaying the records one by one, they are sorted by value so
+ * the last record for each value decides whether it is in the tree. These are
+ * merged with the sorted snapshot and the tree is built at once with
+ * avltree_from_sorted.
+ *
+ * A record cut short by a crash at the end of either journal file is ignored.
+ *
+ * @param path the base path for the journal files.
+ * @param tree set to a pointer to the root of the rebuilt tree, NULL if it is empty.
+ * @return 0 on success, -1 if the files could not be read.
+ */
+int avltree_journal_replay(const char* path, avltree_t** tree) {
+    char* snapshot_path = avltree_journal_path(path, ".snapshot");
+    char* old_path      = avltree_journal_path(path, ".journal.old");
+    char* journal_path  = avltree_journal_path(path, ".journal");
+
+    char* snapshot       = NULL;
+    size_t snapshot_size = 0;
+    char* old_log        = NULL;
+    size_t old_log_size  = 0;
+    char* log            = NULL;
+    size_t log_size      = 0;
+    int result           = avltree_journal_read(snapshot_path, &snapshot, &snapshot_size);
+    if (result == 0) {
+        result = avltree_journal_read(old_path, &old_log, &old_log_size);
+    }
+    if (result == 0) {
+        result = avltree_journal_read(journal_path, &log, &log_size);
+    }
+    free(snapshot_path);
+    free(old_path);
+    free(journal_path);
+
+    // Each file may end in a record cut short, so they are parsed on their own.
+    size_t values_size                = snapshot_size / sizeof(int);
+    size_t records_size               = old_log_size / AVLTREE_JOURNAL_RECORD_SIZE +
+                                        log_size / AVLTREE_JOURNAL_RECORD_SIZE;
+    const int* values                 = (const int*)snapshot;
+    avltree_journal_record_t* records = malloc((records_size + 1) * sizeof(avltree_journal_record_t));
+    int* merged                       = malloc((values_size + records_size + 1) * sizeof(int));
+    if (result != 0 || records == NULL || merged == NULL) {
+        free(snapshot);
+        free(old_log);
+        free(log);
+        free(records);
+        free(merged);
+        return -1;
+    }
+
+    records_size = 0;
+    avltree_journal_parse(old_log, old_log_size, records, &records_size);
+    avltree_journal_parse(log, log_size, records, &records_size);
+    qsort(records, records_size, sizeof(avltree_journal_record_t), avltree_journal_compare_records);
+
+    size_t merged_size = 0;
+    size_t i           = 0;
+    size_t j           = 0;
+    while (i < values_size || j < records_size) {
+        if (j == records_size || (i < values_size && values[i] < records[j].value)) {
+            merged[merged_size++] = values[i++];
+            continue;
+        }
+
+        // The last record for a value overrides the snapshot.
+        int value = records[j].value;
+        while (j + 1 < records_size && records[j + 1].value == value) {
+            j++;
+        }
+        if (records[j].operation == AVLTREE_JOURNAL_INSERT) {
+            merged[merged_size++] = value;
+        }
+        j++;
+
+        if (i < values_size && values[i] == value) {
+            i++;
+        }
+    }
+
+    *tree = avltree_from_sorted(merged, merged_size);
+
+    free(snapshot);
+    free(old_log);
+    free(log);
+    free(records);
+    free(merged);
+    return 0;
+}
+
+/**
+ * An in-order iterator over a tree, using an explicit stack of the nodes
+ * still to be visited. The stack needs room for as many nodes as the height
+ * of the tree.
+ */
+typedef struct {
+    const avltree_t** stack;
+    size_t size;
+} avltree_iterator_t;
+
+/**
+ * This is an inner function, it pushes a node and its left spine on the stack
+ * of an iterator.
+ */
+void avltree_iterator_push(avltree_iterator_t* iterator, const avltree_t* node) {
+    for (; node != NULL; node = node->left) {
+        iterator->stack[iterator->size++] = node;
+    }
+}
+
+/**
+ * Start iterating over a tree.
+ *
+ * @param iterator a pointer to the iterator to initialize.
+ * @param tree a pointer to the root of the tree.
+ * @param stack an array with room for as many nodes as the height of the tree.
+ */
+void avltree_iterator_init(avltree_iterator_t* iterator, const avltree_t* tree, const avltree_t** stack) {
+    iterator->stack = stack;
+    iterator->size  = 0;
+    avltree_iterator_push(iterator, tree);
+}
+
+/**
+ * Get the next node of an iterator, in order.
+ *
+ * @param iterator a pointer to the iterator.
+ * @return a pointer to the next node, NULL once all nodes have been visited.
+ */
+const avltree_t* avltree_iterator_next(avltree_iterator_t* iterator) {
+    if (iterator->size == 0) {
+        return NULL;
+    }
+
+    const avltree_t* node = iterator->stack[--iterator->size];
+    avltree_iterator_push(iterator, node->right);
+    return node;
+}
+
+/**
+ * Nodes of a sharded tree are carved out of slabs owned by their shard, and
+ * freed nodes are kept for reuse by that same shard. They are released all at
+ * once by avltree_pool_clear, so they must never be passed to avltree_free.
+ */
+#define AVLTREE_POOL_SLAB_SIZE 1024
+
+typedef struct avltree_pool_slab_s {
+    struct avltree_pool_slab_s* next;
+    avltree_t nodes[AVLTREE_POOL_SLAB_SIZE];
+} avltree_pool_slab_t;
+
+typedef struct {
+    avltree_pool_slab_t* slabs;
+    size_t slab_used;
+    avltree_t* free_nodes;
+} avltree_pool_t;
+
+/**
+ * Create a new avltree_t node from a pool, growing it by a slab if needed.
+ *
+ * @param pool a pointer to the pool.
+ * @param value an integer to be stored in the new node.
+ * @return a pointer to the new node. Null if we fail to allocate memory.
+ */
+avltree_t* avltree_pool_new_node(avltree_pool_t* pool, int value) {
+    avltree_t* node = pool->free_nodes;
+    if (node != NULL) {
+        pool->free_nodes = node->left;
+    } else {
+        if (pool->slabs == NULL || pool->slab_used == AVLTREE_POOL_SLAB_SIZE) {
+            avltree_pool_slab_t* slab = malloc(sizeof(avltree_pool_slab_t));
+            if (slab == NULL) {
+                return NULL;
+            }
+
+            slab->next      = pool->slabs;
+            pool->slabs     = slab;
+            pool->slab_used = 0;
+        }
+        node = &pool->slabs->nodes[pool->slab_used++];
+    }
+
+    memset(node, 0, sizeof(avltree_t));
+    node->content = value;
+    node->height  = 1;
+    node->count   = 1;
+#ifdef AVLTREE_AGGREGATE
+    node->aggregate = avltree_aggregate_of(value, 1);
+#endif
+    return node;
+}
+
+/**
+ * Return a single node to the pool it was taken from, for reuse.
+ *
+ * @param pool a pointer to the pool.
+ * @param node a pointer to the node, already unlinked from its tree.
+ */
+void avltree_pool_free_node(avltree_pool_t* pool, avltree_t* node) {
+    node->left       = pool->free_nodes;
+    pool->free_nodes = node;
+}
+
+/**
+ * Release all the memory held by a pool, including the nodes still in use.
+ *
+ * @param pool a pointer to the pool.
+ */
+void avltree_pool_clear(avltree_pool_t* pool) {
+    while (pool->slabs != NULL) {
+        avltree_pool_slab_t* next = pool->slabs->next;
+        free(pool->slabs);
+        pool->slabs = next;
+    }
+
+    pool->slab_used  = 0;
+    pool->free_nodes = NULL;
+}
+
+/**
+ * This is an inner function, it works like avltree_insert_inner but takes the
+ * new node from a pool.
+ *
+ * @param pool a pointer to the pool the nodes of the tree come from.
+ * @param node a pointer to the current node that is being iterated.
+ * @param parent a pointer to the parent of the current node.
+ * @param value an integer to be used as the content for a new node.
+ */
+avltree_t* avltree_pool_insert_inner(avltree_pool_t* pool, avltree_t* node, avltree_t* parent, int value) {
+    if (node->content == value) {
+        return NULL;
+    }
+
+    avltree_t** child = node->content > value ? &node->left : &node->right;
+    if (*child == NULL) {
+        *child = avltree_pool_new_node(pool, value);
+    } else {
+        avltree_pool_insert_inner(pool, *child, node, value);
+    }
+
+    avltree_update(node);
+
+    return avltree_balance(node, parent);
+}
+
+/**
+ * Insert a value into a tree whose nodes come from a pool.
+ *
+ * @param pool a pointer to the pool the nodes of the tree come from.
+ * @param tree a pointer to the root of the tree, NULL for an empty tree.
+ * @param value an integer to be used as the content for a new node.
+ * @return a pointer to the root of the tree.
+ */
+avltree_t* avltree_pool_insert(avltree_pool_t* pool, avltree_t* tree, int value) {
+    if (tree == NULL) {
+        return avltree_pool_new_node(pool, value);
+    }
+    if (tree->content == value) {
+        return tree;
+    }
+
+    return avltree_pool_insert_inner(pool, tree, NULL, value);
+}
+
+/**
+ * This is an inner function, it works like avltree_delete_inner but returns
+ * the deleted node to a pool.
+ *
+ * @param pool a pointer to the pool the nodes of the tree come from.
+ * @param node a pointer to the current node being probed for the value in the tree.
+ * @param parent a pointer to the parent for the current node.
+ * @param value the integer we are looking for in the tree.
+ * @return a pointer to the new node that took this node's place, the passed in node otherwise.
+ */
+avltree_t* avltree_pool_delete_inner(avltree_pool_t* pool, avltree_t* node, avltree_t* parent, int value) {
+    if (node == NULL) {
+        return NULL;
+    }
+
+    if (node->content == value) {
+        avltree_t* deleted = node;
+        node               = avltree_unlink_node(deleted, parent);
+        avltree_pool_free_node(pool, deleted);
+    } else if (node->content > value) {
+        avltree_pool_delete_inner(pool, node->left, node, value);
+    } else {
+        avltree_pool_delete_inner(pool, node->right, node, value);
+    }
+
+    // If the deleted node was a leaf, nothing left to do.
+    if (node == NULL) {
+        return NULL;
+    }
+
+    avltree_update(node);
+
+    avltree_t* new_node = avltree_balance(node, parent);
+
+    return new_node ? new_node : node;
+}
+
+/**
+ * Convenience macro for deleting a value from a tree whose nodes come from a
+ * pool, the counterpart of avltree_delete.
+ *
+ * @param pool a pointer to the pool the nodes of the tree come from.
+ * @param tree a pointer to the root of the tree to look for the value.
+ * @param value an integer we are looking for in the tree.
+ * @return a pointer to the root of the tree, needed if the root is the node to be removed.
+ */
+#define avltree_pool_delete(pool, tree, value) avltree_pool_delete_inner(pool, tree, NULL, value)
+
+/**
+ * A shard of an avltree_sharded_t, aligned to a cache line so the locks of
+ * neighbouring shards are not falsely shared.
+ */
+typedef struct {
+    pthread_mutex_t lock;
+    avltree_t* root;
+    avltree_pool_t pool;
+} __attribute__((aligned(64))) avltree_shard_t;
+
+/**
+ * A set of values split across independent AVL trees by the hash of the
+ * values. Each shard has its own lock and node pool, so threads writing to
+ * different shards do not contend with each other.
+ */
+typedef struct {
+    avltree_shard_t* shards;
+    size_t shards_size;
+} avltree_sharded_t;
+
+/**
+ * Create an empty sharded tree.
+ *
+ * @param shards the amount of shards to split values across.
+ * @return a pointer to the sharded tree. Null if we fail to allocate memory.
+ */
+avltree_sharded_t* avltree_sharded_new(size_t shards) {
+    if (shards == 0) {
+        return NULL;
+    }
+
+    avltree_sharded_t* tree = malloc(sizeof(avltree_sharded_t));
+    if (tree == NULL) {
+        return NULL;
+    }
+
+    tree->shards      = aligned_alloc(_Alignof(avltree_shard_t), shards * sizeof(avltree_shard_t));
+    tree->shards_size = shards;
+    if (tree->shards == NULL) {
+        free(tree);
+        return NULL;
+    }
+
+    memset(tree->shards, 0, shards * sizeof(avltree_shard_t));
+    for (size_t i = 0; i < shards; i++) {
+        pthread_mutex_init(&tree->shards[i].lock, NULL);
+    }
+    return tree;
+}
+
+/**
+ * Free a sharded tree and all its nodes.
+ *
+ * @param tree a pointer to the sharded tree.
+ */
+void avltree_sharded_free(avltree_sharded_t* tree) {
+    if (tree == NULL) {
+        return;
+    }
+
+    for (size_t i = 0; i < tree->shards_size; i++) {
+        pthread_mutex_destroy(&tree->shards[i].lock);
+        avltree_pool_clear(&tree->shards[i].pool);
+    }
+    free(tree->shards);
+    free(tree);
+}
+
+/**
+ * Get the shard a value belongs to, mixing the value with a multiplicative
+ * hash so runs of consecutive values are spread across all shards.
+ *
+ * @param tree a pointer to the sharded tree.
+ * @param value the value to look for.
+ * @return a pointer to the shard.
+ */
+avltree_shard_t* avltree_sharded_shard(avltree_sharded_t* tree, int value) {
+    uint32_t hash = (uint32_t)value * 0x9E3779B1u;
+    return &tree->shards[((uint64_t)hash * tree->shards_size) >> 32];
+}
+
+/**
+ * Insert a value into a sharded tree. Safe to call from multiple threads.
+ *
+ * @param tree a pointer to the sharded tree.
+ * @param value an integer to be used as the content for a new node.
+ */
+void avltree_sharded_insert(avltree_sharded_t* tree, int value) {
+    avltree_shard_t* shard = avltree_sharded_shard(tree, value);
+
+    pthread_mutex_lock(&shard->lock);
+    shard->root = avltree_pool_insert(&shard->pool, shard->root, value);
+    pthread_mutex_unlock(&shard->lock);
+}
+
+/**
+ * Delete a value from a sharded tree. Safe to call from multiple threads.
+ *
+ * @param tree a pointer to the sharded tree.
+ * @param value an integer we are looking for in the tree.
+ */
+void avltree_sharded_delete(avltree_sharded_t* tree, int value) {
+    avltree_shard_t* shard = avltree_sharded_shard(tree, value);
+
+    pthread_mutex_lock(&shard->lock);
+    shard->root = avltree_pool_delete(&shard->pool, shard->root, value);
+    pthread_mutex_unlock(&shard->lock);
+}
+
+/**
+ * Search for a value in a sharded tree. Safe to call from multiple threads.
+ *
+ * Unlike avltree_search, the node is not returned since another thread could
+ * delete it as soon as the shard is unlocked.
+ *
+ * @param tree a pointer to the sharded tree.
+ * @param value an integer to look for in the tree.
+ * @return 1 if the value is in the tree, 0 otherwise.
+ */
+int avltree_sharded_search(avltree_sharded_t* tree, int value) {
+    avltree_shard_t* shard = avltree_sharded_shard(tree, value);
+
+    pthread_mutex_lock(&shard->lock);
+    int found = avltree_search(shard->root, value) != NULL;
+    pthread_mutex_unlock(&shard->lock);
+    return found;
+}
+
+/**
+ * This is an inner function, it restores the heap property of the scan heap
+ * from the provided position downwards. The heap holds the index of the
+ * iterators, ordered by the value of their current node.
+ */
+void avltree_sharded_sift_down(size_t heap[], size_t heap_size, const avltree_t* current[], size_t i) {
+    for (;;) {
+        size_t smallest = i;
+        size_t left     = 2 * i + 1;
+        size_t right    = 2 * i + 2;
+        if (left < heap_size && current[heap[left]]->content < current[heap[smallest]]->content) {
+            smallest = left;
+        }
+        if (right < heap_size && current[heap[right]]->content < current[heap[smallest]]->content) {
+            smallest = right;
+        }
+        if (smallest == i) {
+            return;
+        }
+
+        size_t tmp     = heap[i];
+        heap[i]        = heap[smallest];
+        heap[smallest] = tmp;
+        i              = smallest;
+    }
+}
+
+/**
+ * Visit all values in a sharded tree in order. Every shard is iterated in
+ * order on its own and a min-heap over the shards merges them, taking
+ * O(n log k) for k shards.
+ *
+ * All shards are locked for the duration of the scan, so visit must not
+ * modify the tree.
+ *
+ * @param tree a pointer to the sharded tree.
+ * @param visit a function called with each value and the provided data.
+ * @param data a pointer passed as is to visit.
+ * @return 0 on success, -1 if we fail to allocate memory.
+ */
+int avltree_sharded_scan(avltree_sharded_t* tree, void (*visit)(int value, void* data), void* data) {
+    size_t shards = tree->shards_size;
+
+    // Shards are always locked in the same order, so concurrent scans cannot deadlock.
+    size_t stack_size = 0;
+    for (size_t i = 0; i < shards; i++) {
+        pthread_mutex_lock(&tree->shards[i].lock);
+        stack_size += avltree_get_height(tree->shards[i].root);
+    }
+
+    avltree_iterator_t* iterators = malloc(shards * sizeof(avltree_iterator_t));
+    const avltree_t** current     = malloc(shards * sizeof(avltree_t*));
+    size_t* heap                  = malloc(shards * sizeof(size_t));
+    const avltree_t** stacks      = malloc((stack_size + 1) * sizeof(avltree_t*));
+    int result                    = iterators != NULL && current != NULL && heap != NULL && stacks != NULL ? 0 : -1;
+
+    if (result == 0) {
+        size_t heap_size = 0;
+        size_t offset    = 0;
+        for (size_t i = 0; i < shards; i++) {
+            avltree_iterator_init(&iterators[i], tree->shards[i].root, stacks + offset);
+            offset += avltree_get_height(tree->shards[i].root);
+
+            current[i] = avltree_iterator_next(&iterators[i]);
+            if (current[i] != NULL) {
+                heap[heap_size++] = i;
+            }
+        }
+
+        for (size_t i = heap_size / 2; i-- > 0;) {
+            avltree_sharded_sift_down(heap, heap_size, current, i);
+        }
+
+        while (heap_size > 0) {
+            size_t shard = heap[0];
+            visit(current[shard]->content, data);
+
+            current[shard] = avltree_iterator_next(&iterators[shard]);
+            if (current[shard] == NULL) {
+                heap[0] = heap[--heap_size];
+            }
+            avltree_sharded_sift_down(heap, heap_size, current, 0);
+        }
+    }
+
+    for (size_t i = shards; i-- > 0;) {
+        pthread_mutex_unlock(&tree->shards[i].lock);
+    }
+
+    free(iterators);
+    free(current);
+    free(heap);
+    free(stacks);
+    return result;
+}
+
+/**
+ * Count the nodes in a tree.
+ *
+ * @param tree a pointer to the root of the tree.
+ * @return the amount of nodes allocated for the tree.
+ */
+size_t avltree_count_nodes(const avltree_t* tree) {
+    if (tree == NULL) {
+        return 0;
+    }
+
+    return 1 + avltree_count_nodes(tree->left) + avltree_count_nodes(tree->right);
+}
+
+/**
+ * Size of an avltree_filter_t per value, giving a false positive rate close
+ * to 1% while it is full.
+ */
+#define AVLTREE_FILTER_BITS_PER_VALUE 10
+
+/**
+ * Amount of 64 bit words per block of an avltree_filter_t, a block is a full
+ * cache line.
+ */
+#define AVLTREE_FILTER_BLOCK_WORDS 8
+
+/**
+ * A blocked Bloom filter in front of a tree, rejecting most searches for
+ * missing values without walking the tree.
+ *
+ * Bits cannot be cleared on delete, so values counts every value added since
+ * the last rebuild, deleted or not. Once it goes over capacity the filter is
+ * rebuilt from the tree, sized for twice the values left in it.
+ */
+typedef struct {
+    uint64_t* blocks;
+    size_t blocks_size;
+    size_t values;
+    size_t capacity;
+} avltree_filter_t;
+
+/**
+ * Hash a value for an avltree_filter_t, the high half picks the block and
+ * the low half the bits within it.
+ *
+ * @param value the value to be hashed.
+ * @return the hash for the value.
+ */
+uint64_t avltree_filter_hash(int value) {
+    uint64_t hash = (uint32_t)value;
+    hash          = (hash ^ (hash >> 30)) * 0xbf58476d1ce4e5b9ULL;
+    hash          = (hash ^ (hash >> 27)) * 0x94d049bb133111ebULL;
+    return hash ^ (hash >> 31);
+}
+
+/**
+ * This is an inner function, it gets the block of a filter a value maps to
+ * and the bit to be set in each of its words.
+ */
+uint64_t* avltree_filter_block(const avltree_filter_t* filter, int value, uint64_t bits[]) {
+    static const uint32_t salts[AVLTREE_FILTER_BLOCK_WORDS] = {0x47b6137b, 0x44974d91, 0x8824ad5b, 0xa2b7289d,
+                                                               0x705495c7, 0x2df1424b, 0x9efc4947, 0x5c6bfb31};
+    uint64_t hash = avltree_filter_hash(value);
+    for (int i = 0; i < AVLTREE_FILTER_BLOCK_WORDS; i++) {
+        bits[i] = 1ULL << (((uint32_t)hash * salts[i]) >> 26);
+    }
+
+    size_t block = ((hash >> 32) * filter->blocks_size) >> 32;
+    return filter->blocks + block * AVLTREE_FILTER_BLOCK_WORDS;
+}
+
+/**
+ * Add a value to a filter.
+ *
+ * @param filter a pointer to the filter.
+ * @param value the value to be added.
+ */
+void avltree_filter_add(avltree_filter_t* filter, int value) {
+    uint64_t bits[AVLTREE_FILTER_BLOCK_WORDS];
+    uint64_t* block = avltree_filter_block(filter, value, bits);
+    for (int i = 0; i < AVLTREE_FILTER_BLOCK_WORDS; i++) {
+        block[i] |= bits[i];
+    }
+    filter->values++;
+}
+
+/**
+ * Check whether a value may be in the tree behind a filter, touching a single
+ * cache line.
+ *
+ * @param filter a pointer to the filter.
+ * @param value the value to look for.
+ * @return 0 if the value is surely not in the tree, 1 if it may be.
+ */
+int avltree_filter_contains(const avltree_filter_t* filter, int value) {
+    uint64_t bits[AVLTREE_FILTER_BLOCK_WORDS];
+    const uint64_t* block = avltree_filter_block(filter, value, bits);
+
+    uint64_t missing = 0;
+    for (int i = 0; i < AVLTREE_FILTER_BLOCK_WORDS; i++) {
+        missing |= bits[i] & ~block[i];
+    }
+    return missing == 0;
+}
+
+/**
+ * This is an inner function, it adds all the values in a tree to a filter.
+ */
+void avltree_filter_add_tree(avltree_filter_t* filter, const avltree_t* tree) {
+    if (tree == NULL) {
+        return;
+    }
+
+    avltree_filter_add(filter, tree->content);
+    avltree_filter_add_tree(filter, tree->left);
+    avltree_filter_add_tree(filter, tree->right);
+}
+
+/**
+ * Rebuild a filter from the values in a tree, dropping the bits left behind
+ * by deleted values and making room for as many values as there are in the
+ * tree.
+ *
+ * @param filter a pointer to the filter.
+ * @param tree a pointer to the root of the tree.
+ * @return 0 on success, -1 if we fail to allocate memory, leaving the filter as it was.
+ */
+int avltree_filter_rebuild(avltree_filter_t* filter, const avltree_t* tree) {
+    size_t values      = avltree_count_nodes(tree);
+    size_t capacity    = values > 512 ? 2 * values : 1024;
+    size_t block_bits  = AVLTREE_FILTER_BLOCK_WORDS * 64;
+    size_t blocks_size = (capacity * AVLTREE_FILTER_BITS_PER_VALUE + block_bits - 1) / block_bits;
+    size_t block_bytes = AVLTREE_FILTER_BLOCK_WORDS * sizeof(uint64_t);
+
+    uint64_t* blocks = aligned_alloc(block_bytes, blocks_size * block_bytes);
+    if (blocks == NULL) {
+        return -1;
+    }
+
+    memset(blocks, 0, blocks_size * block_bytes);
+    free(filter->blocks);
+    filter->blocks      = blocks;
+    filter->blocks_size = blocks_size;
+    filter->values      = 0;
+    filter->capacity    = capacity;
+
+    avltree_filter_add_tree(filter, tree);
+    return 0;
+}
+
+/**
+ * Create a filter for a tree, holding the values already in it.
+ *
+ * @param tree a pointer to the root of the tree, NULL for an empty tree.
+ * @return a pointer to the filter. Null if we fail to allocate memory.
+ */
+avltree_filter_t* avltree_filter_new(const avltree_t* tree) {
+    avltree_filter_t* filter = calloc(1, sizeof(avltree_filter_t));
+    if (filter == NULL) {
+        return NULL;
+    }
+
+    if (avltree_filter_rebuild(filter, tree) != 0) {
+        free(filter);
+        return NULL;
+    }
+    return filter;
+}
+
+/**
+ * Free a filter, the tree behind it is left untouched.
+ *
+ * @param filter a pointer to the filter.
+ */
+void avltree_filter_free(avltree_filter_t* filter) {
+    if (filter == NULL) {
+        return;
+    }
+
+    free(filter->blocks);
+    free(filter);
+}
+
+/**
+ * Insert a value into a tree, keeping its filter in sync. Only values the tree
+ * did not hold yet are added to the filter, so duplicates do not use up its
+ * capacity.
+ *
+ * @param filter a pointer to the filter of the tree.
+ * @param tree a pointer to the root of the tree, NULL for an empty tree.
+ * @param value an integer to be used as the content for a new node.
+ * @return a pointer to the root of the tree.
+ */
+avltree_t* avltree_filter_insert(avltree_filter_t* filter, avltree_t* tree, int value) {
+    if (avltree_search(tree, value) != NULL) {
+        return tree;
+    }
+
+    tree = tree == NULL ? avltree_new_node(value) : avltree_insert(tree, value);
+    if (avltree_search(tree, value) == NULL) {
+        // We failed to allocate the node, there is nothing new to add.
+        return tree;
+    }
+
+    // If the filter is full and cannot grow, it keeps taking values at the cost of more false positives.
+    if (filter->values < filter->capacity || avltree_filter_rebuild(filter, tree) != 0) {
+        avltree_filter_add(filter, value);
+    }
+    return tree;
+}
+
+/**
+ * Delete a value from a tree. The value is left in the filter, which is only
+ * cleaned up by the next rebuild.
+ *
+ * @param filter a pointer to the filter of the tree.
+ * @param tree a pointer to the root of the tree.
+ * @param value an integer we are looking for in the tree.
+ * @return a pointer to the root of the tree, needed if the root is the node to be removed.
+ */
+avltree_t* avltree_filter_delete(avltree_filter_t* filter, avltree_t* tree, int value) {
+    (void)filter;
+    return avltree_delete(tree, value);
+}
+
+/**
+ * Search for a value in a tree, only walking the tree if its filter says the
+ * value may be there.
+ *
+ * @param filter a pointer to the filter of the tree.
+ * @param tree a pointer to the root of the tree.
+ * @param value an integer to look for in the tree.
+ * @return a pointer to the node holding the value, NULL if the value is not in the tree.
+ */
+avltree_t* avltree_filter_search(const avltree_filter_t* filter, avltree_t* tree, int value) {
+    if (!avltree_filter_contains(filter, value)) {
+        return NULL;
+    }
+    return avltree_search(tree, value);
+}
+
+/**
+ * A double-ended priority queue on top of an AVL tree used as a multiset,
+ * with cached pointers to the nodes holding the smallest and biggest values.
+ *
+ * Rotations, rebalancing and avltree_replace_node relink nodes but never
+ * change their content, and the only node they free is the one holding the
+ * deleted value. The cached nodes therefore stay valid through any change to
+ * the tree, except for removing the extreme values themselves, which is
+ * handled by the queue functions.
+ */
+typedef struct {
+    avltree_t* root;
+    avltree_t* min;
+    avltree_t* max;
+    size_t size;
+} avltree_queue_t;
+
+/**
+ * Create an empty queue.
+ *
+ * @return a pointer to the queue. Null if we fail to allocate memory.
+ */
+avltree_queue_t* avltree_queue_new() {
+    return calloc(1, sizeof(avltree_queue_t));
+}
+
+/**
+ * Free a queue and all the values in it.
+ *
+ * @param queue a pointer to the queue.
+ */
+void avltree_queue_free(avltree_queue_t* queue) {
+    if (queue == NULL) {
+        return;
+    }
+
+    avltree_free(queue->root);
+    free(queue);
+}
+
+/**
+ * This is an inner function, it finds the smallest or biggest node in a tree
+ * by walking its left or right spine.
+ */
+avltree_t* avltree_queue_extreme(avltree_t* node, avltree_pop_bias_t bias) {
+    if (node == NULL) {
+        return NULL;
+    }
+
+    if (bias == SMALLEST) {
+        while (node->left != NULL) {
+            node = node->left;
+        }
+    } else {
+        while (node->right != NULL) {
+            node = node->right;
+        }
+    }
+    return node;
+}
+
+/**
+ * Add a value to a queue. Values can be added multiple times.
+ *
+ * @param queue a pointer to the queue.
+ * @param value the value to be added.
+ */
+void avltree_queue_push(avltree_queue_t* queue, int value) {
+    if (queue->root == NULL) {
+        queue->root = avltree_new_node(value);
+        queue->min  = queue->root;
+        queue->max  = queue->root;
+        queue->size = queue->root != NULL;
+        return;
+    }
+
+    int counted = 0;
+    queue->root = avltree_insert_multi_inner(queue->root, value, &counted);
+    if (!counted) {
+        // We failed to allocate a node for the value, the queue is unchanged.
+        return;
+    }
+    queue->size++;
+
+    // A new extreme is the only way the cached nodes can change on insert.
+    if (value < queue->min->content) {
+        queue->min = avltree_queue_extreme(queue->root, SMALLEST);
+    } else if (value > queue->max->content) {
+        queue->max = avltree_queue_extreme(queue->root, BIGGEST);
+    }
+}
+
+/**
+ * Get the node holding the smallest value in a queue, in O(1).
+ *
+ * @param queue a pointer to the queue.
+ * @return a pointer to the node, NULL if the queue is empty.
+ */
+const avltree_t* avltree_queue_peek_min(const avltree_queue_t* queue) {
+    return queue->min;
+}
+
+/**
+ * Get the node holding the biggest value in a queue, in O(1).
+ *
+ * @param queue a pointer to the queue.
+ * @return a pointer to the node, NULL if the queue is empty.
+ */
+const avltree_t* avltree_queue_peek_max(const avltree_queue_t* queue) {
+    return queue->max;
+}
+
+/**
+ * This is an inner function, it removes one occurrence of the smallest or
+ * biggest value from a queue.
+ *
+ * Instead of searching for the value and going through avltree_delete, the
+ * extreme node is unlinked with avltree_pop_leaf, which follows a single
+ * spine without comparing values. Removing it can shorten every subtree on
+ * that spine, and avltree_pop_leaf rebalances each of them on its way back up
+ * through their parents. The root has no parent to do that for it, so it is
+ * rebalanced here afterwards.
+ */
+int avltree_queue_pop(avltree_queue_t* queue, avltree_pop_bias_t bias, int* value) {
+    avltree_t* node = bias == SMALLEST ? queue->min : queue->max;
+    if (node == NULL) {
+        return -1;
+    }
+
+    *value = node->content;
+    queue->size--;
+
+    if (node->count > 1) {
+        node->count--;
+#ifdef AVLTREE_AGGREGATE
+        avltree_update_path(queue->root, node->content);
+#endif
+        return 0;
+    }
+
+    if (node == queue->root) {
+        queue->root = bias == SMALLEST ? node->right : node->left;
+        node->left  = node->right = NULL;
+    } else {
+        avltree_pop_leaf(queue->root, bias);
+        queue->root = avltree_balance(queue->root, NULL);
+    }
+    avltree_free(node);
+
+    if (bias == SMALLEST) {
+        queue->min = avltree_queue_extreme(queue->root, SMALLEST);
+    } else {
+        queue->max = avltree_queue_extreme(queue->root, BIGGEST);
+    }
+    if (queue->root == NULL) {
+        queue->min = queue->max = NULL;
+    }
+    return 0;
+}
+
+/**
+ * Remove one occurrence of the smallest value from a queue.
+ *
+ * @param queue a pointer to the queue.
+ * @param value set to the removed value.
+ * @return 0 on success, -1 if the queue is empty.
+ */
+int avltree_queue_pop_min(avltree_queue_t* queue, int* value) {
+    return avltree_queue_pop(queue, SMALLEST, value);
+}
+
+/**
+ * Remove one occurrence of the biggest value from a queue.
+ *
+ * @param queue a pointer to the queue.
+ * @param value set to the removed value.
+ * @return 0 on success, -1 if the queue is empty.
+ */
+int avltree_queue_pop_max(avltree_queue_t* queue, int* value) {
+    return avltree_queue_pop(queue, BIGGEST, value);
+}
+
+/**
+ * Remove one occurrence of any value from a queue, like a cancelled deadline.
+ *
+ * @param queue a pointer to the queue.
+ * @param value the value to be removed.
+ */
+void avltree_queue_delete(avltree_queue_t* queue, int value) {
+    unsigned long long count = avltree_count(queue->root, value);
+    if (count == 0) {
+        return;
+    }
+
+    // Only the node holding the value can be freed, the others stay valid.
+    int was_min = count == 1 && value == queue->min->content;
+    int was_max = count == 1 && value == queue->max->content;
+
+    queue->root = avltree_delete_multi(queue->root, value);
+    queue->size--;
+
+    if (was_min) {
+        queue->min = avltree_queue_extreme(queue->root, SMALLEST);
+    }
+    if (was_max) {
+        queue->max = avltree_queue_extreme(queue->root, BIGGEST);
+    }
+}
+
+/**
+ * Print a formatted node of a tree. This is an inner function and you should
+ * use avltree_print instead.
+ *
+ * @param tree a pointer to the current node to print.
+ * @param pointy a string with the arrow that should be printed next to the node.
+ * @param padding a string with the padding needed for the tree to look nice.
+ */
+void avltree_print_inner(const avltree_t* tree, const char* pointy, char padding[1024]) {
+    if (tree == NULL) {
+        return;
+    }
+
+    if (tree->count > 1) {
+        printf("%s%d (x%llu)\n", pointy, tree->content, tree->count);
+    } else {
+        printf("%s%d\n", pointy, tree->content);
+    }
+
+    if (tree->left == NULL && tree->right == NULL) {
+        return;
+    }
+
+    if (tree->left) {
+        printf("%s", padding);
+        strcat(padding, "|   ");
+        avltree_print_inner(tree->left, "|-> ", padding);
+        padding[strlen(padding) - 4] = '\0';
+    } else {
+        printf("%s%s\n", padding, "|-> ");
+    }
+
+    if (tree->right) {
+        printf("%s", padding);
+        strcat(padding, "    ");
+        avltree_print_inner(tree->right, "┗-> ", padding);
+        padding[strlen(padding) - 4] = '\0';
+    } else {
+        printf("%s%s\n", padding, "┗-> ");
+    }
+}
+
+/**
+ * Print a tree in a nice way.
+ *
+ * @param tree a pointer to the tree to be printed.
+ */
+void avltree_print(const avltree_t* tree) {
+    char padding[1024] = {0};
+    if (tree == NULL) {
+        return;
+    }
+
+    avltree_print_inner(tree, "", padding);
+}
+
+/**
+ * Get a monotonic timestamp, used for measuring elapsed time in benchmarks.
+ *
+ * @return the current time in seconds.
+ */
+double bench_now() {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+/**
+ * Benchmark the multiset mode on a stream with a high amount of duplicates.
+ *
+ * @param events the amount of values in the stream.
+ * @param distinct the amount of distinct values in the stream.
+ */
+void avltree_bench_multiset(size_t events, int distinct) {
+    int* stream = events > 0 ? malloc(events * sizeof(int)) : NULL;
+    if (stream == NULL) {
+        printf("Failed to allocate benchmark stream\n");
+        return;
+    }
+
+    srand(42);
+    for (size_t i = 0; i < events; i++) {
+        stream[i] = rand() % distinct;
+    }
+
+    double start    = bench_now();
+    avltree_t* root = avltree_new_node(stream[0]);
+    for (size_t i = 1; i < events; i++) {
+        root = avltree_insert_multi(root, stream[i]);
+    }
+    double insert_time = bench_now() - start;
+
+    unsigned long long total = 0;
+    for (int i = 0; i < distinct; i++) {
+        total += avltree_count(root, i);
+    }
+
+    size_t nodes = avltree_count_nodes(root);
+
+    start = bench_now();
+    for (size_t i = 0; i < events && root != NULL; i++) {
+        root = avltree_delete_multi(root, stream[i]);
+    }
+    double delete_time = bench_now() - start;
+
+    printf("multiset: %zu events, %d distinct -> %zu nodes (%zu bytes), counted %llu\n", events, distinct, nodes,
+           nodes * sizeof(avltree_t), total);
+    printf("  insert: %.2f Mops/s\n", events / insert_time / 1e6);
+    printf("  delete: %.2f Mops/s, tree empty: %s\n", events / delete_time / 1e6, root == NULL ? "yes" : "no");
+
+    avltree_free(root);
+    free(stream);
+}
+
+/**
+ * Benchmark searching for values one at a time against avltree_search_batch
+ * on a tree built from random values.
+ *
+ * @param size the amount of values inserted in the tree.
+ * @param lookups the amount of values to look for, half of them are in the tree.
+ */
+void avltree_bench_search_batch(size_t size, size_t lookups) {
+    int* keys           = malloc(size * sizeof(int));
+    int* values         = malloc(lookups * sizeof(int));
+    avltree_t** results = malloc(lookups * sizeof(avltree_t*));
+    if (size == 0 || keys == NULL || values == NULL || results == NULL) {
+        printf("Failed to allocate benchmark data\n");
+        free(keys);
+        free(values);
+        free(results);
+        return;
+    }
+
+    srand(42);
+    for (size_t i = 0; i < size; i++) {
+        keys[i] = rand();
+    }
+    for (size_t i = 0; i < lookups; i++) {
+        values[i] = keys[rand() % size] + (i & 1);
+    }
+
+    avltree_t* root = avltree_new_node(keys[0]);
+    for (size_t i = 1; i < size; i++) {
+        root = avltree_insert(root, keys[i]);
+    }
+
+    size_t found = 0;
+    double start = bench_now();
+    for (size_t i = 0; i < lookups; i++) {
+        found += avltree_search(root, values[i]) != NULL;
+    }
+    double single_time = bench_now() - start;
+
+    start = bench_now();
+    avltree_search_batch(root, values, lookups, results);
+    double batch_time = bench_now() - start;
+
+    size_t mismatches = 0;
+    for (size_t i = 0; i < lookups; i++) {
+        mismatches += results[i] != avltree_search(root, values[i]);
+    }
+
+    printf("search batch: %zu nodes (%zu MB), %zu lookups, %zu found\n", size, size * sizeof(avltree_t) >> 20, lookups,
+           found);
+    printf("  one at a time: %.2f Mops/s\n", lookups / single_time / 1e6);
+    printf("  batched:       %.2f Mops/s, mismatches: %zu\n", lookups / batch_time / 1e6, mismatches);
+
+    avltree_free(root);
+    free(keys);
+    free(values);
+    free(results);
+}
+
+/**
+ * Sum the values in a tree within [lower, upper] by visiting every node in
+ * the range, which is what range queries take without aggregates.
+ *
+ * @param node a pointer to the root of the tree.
+ * @param lower the smallest value to include.
+ * @param upper the biggest value to include.
+ * @return the sum of the values in the range.
+ */
+long long avltree_range_sum_walk(const avltree_t* node, int lower, int upper) {
+    if (node == NULL) {
+        return 0;
+    }
+
+    long long sum = 0;
+    if (node->content > lower) {
+        sum += avltree_range_sum_walk(node->left, lower, upper);
+    }
+    if (node->content >= lower && node->content <= upper) {
+        sum += (long long)node->content * (long long)node->count;
+    }
+    if (node->content < upper) {
+        sum += avltree_range_sum_walk(node->right, lower, upper);
+    }
+    return sum;
+}
+
+/**
+ * Benchmark inserting random values and summing them over random ranges. When
+ * built with AVLTREE_AGGREGATE the sums are also computed from the aggregates,
+ * so comparing the insert throughput of both builds gives the cost of keeping
+ * them up to date.
+ *
+ * @param size the amount of values inserted in the tree.
+ * @param queries the amount of ranges to sum.
+ */
+void avltree_bench_range_aggregate(size_t size, size_t queries) {
+    srand(42);
+
+    double start    = bench_now();
+    avltree_t* root = avltree_new_node(rand() % (size * 4));
+    for (size_t i = 1; i < size; i++) {
+        root = avltree_insert(root, rand() % (size * 4));
+    }
+    double insert_time = bench_now() - start;
+
+    int* lowers = malloc(queries * sizeof(int));
+    int* uppers = malloc(queries * sizeof(int));
+    if (lowers == NULL || uppers == NULL) {
+        printf("Failed to allocate benchmark data\n");
+        free(lowers);
+        free(uppers);
+        avltree_free(root);
+        return;
+    }
+
+    for (size_t i = 0; i < queries; i++) {
+        lowers[i] = rand() % (size * 4);
+        uppers[i] = lowers[i] + rand() % (size * 4 - lowers[i]);
+    }
+
+    long long walk_total = 0;
+    start                = bench_now();
+    for (size_t i = 0; i < queries; i++) {
+        walk_total += avltree_range_sum_walk(root, lowers[i], uppers[i]);
+    }
+    double walk_time = bench_now() - start;
+
+    printf("range sums: %zu nodes, %zu queries\n", size, queries);
+    printf("  insert:         %.2f Mops/s\n", size / insert_time / 1e6);
+    printf("  walk:           %.2f Kqueries/s\n", queries / walk_time / 1e3);
+
+#ifdef AVLTREE_AGGREGATE
+    long long aggregate_total = 0;
+    start                     = bench_now();
+    for (size_t i = 0; i < queries; i++) {
+        aggregate_total += avltree_range_aggregate(root, lowers[i], uppers[i]).sum;
+    }
+    double aggregate_time = bench_now() - start;
+
+    printf("  aggregate:      %.2f Kqueries/s, matches walk: %s\n", queries / aggregate_time / 1e3,
+           aggregate_total == walk_total ? "yes" : "no");
+#endif
+
+    avltree_free(root);
+    free(lowers);
+    free(uppers);
+}
+
+/**
+ * Count the nodes of a tree whose value is missing from another tree.
+ *
+ * @param tree a pointer to the root of the tree to check.
+ * @param other a pointer to the root of the tree to look in.
+ * @return the amount of values missing from other.
+ */
+size_t avltree_bench_missing(const avltree_t* tree, avltree_t* other) {
+    if (tree == NULL) {
+        return 0;
+    }
+
+    return (avltree_search(other, tree->content) == NULL) + avltree_bench_missing(tree->left, other) +
+           avltree_bench_missing(tree->right, other);
+}
+
+/**
+ * Benchmark the overhead of journaling inserts and deletes at several commit
+ * intervals, then replaying the journal before and after compacting it.
+ *
+ * @param operations the amount of inserts and deletes, a third of them are deletes.
+ */
+void avltree_bench_journal(size_t operations) {
+    const char* path                = "/tmp/avltree-bench";
+    unsigned int commit_intervals[] = {1, 16, 256, 4096, 0};
+
+    printf("journal: %zu operations\n", operations);
+    for (size_t c = 0; c < sizeof(commit_intervals) / sizeof(commit_intervals[0]); c++) {
+        avltree_journal_remove(path);
+        avltree_journal_t* journal = avltree_journal_open(path, commit_intervals[c]);
+        if (journal == NULL) {
+            return;
+        }
+
+        srand(42);
+        double start    = bench_now();
+        avltree_t* root = NULL;
+        for (size_t i = 0; i < operations; i++) {
+            root = avltree_journal_insert(journal, root, rand() % operations);
+            if (i % 3 == 2) {
+                root = avltree_journal_delete(journal, root, rand() % operations);
+            }
+        }
+        avltree_journal_commit(journal);
+        double journal_time = bench_now() - start;
+
+        char label[16];
+        snprintf(label, sizeof(label), commit_intervals[c] != 0 ? "%u" : "close", commit_intervals[c]);
+
+        avltree_t* replayed = NULL;
+        start               = bench_now();
+        avltree_journal_replay(path, &replayed);
+        double replay_time = bench_now() - start;
+        size_t mismatches  = avltree_bench_missing(root, replayed) + avltree_bench_missing(replayed, root);
+        avltree_free(replayed);
+
+        start = bench_now();
+        avltree_journal_compact(journal, root);
+        double compact_time = bench_now() - start;
+        avltree_journal_close(journal);
+
+        replayed = NULL;
+        start    = bench_now();
+        avltree_journal_replay(path, &replayed);
+        double snapshot_replay_time = bench_now() - start;
+
+        mismatches += avltree_bench_missing(root, replayed) + avltree_bench_missing(replayed, root);
+        avltree_free(replayed);
+        avltree_free(root);
+
+        printf("  commit every %-5s:   %8.3f Mops/s, replay %.2f ms, compact %.2f ms, replay snapshot %.2f ms, "
+               "mismatches: %zu\n",
+               label, operations / journal_time / 1e6, replay_time * 1e3, compact_time * 1e3,
+               snapshot_replay_time * 1e3, mismatches);
+    }
+
+    avltree_journal_remove(path);
+
+    srand(42);
+    double start    = bench_now();
+    avltree_t* root = NULL;
+    for (size_t i = 0; i < operations; i++) {
+        root = avltree_journal_insert(NULL, root, rand() % operations);
+        if (i % 3 == 2) {
+            root = avltree_journal_delete(NULL, root, rand() % operations);
+        }
+    }
+    double base_time = bench_now() - start;
+    avltree_free(root);
+    printf("  no journal:           %8.3f Mops/s\n", operations / base_time / 1e6);
+}
+
+/**
+ * Benchmark avltree_search with and without an avltree_filter_t in front of
+ * it for a growing share of missing values, then again after replacing half
+ * of the values in the tree.
+ *
+ * @param size the amount of values inserted in the tree.
+ * @param lookups the amount of values to look for.
+ */
+void avltree_bench_filter(size_t size, size_t lookups) {
+    const double miss_ratios[] = {0, 0.5, 0.9, 0.99, 1};
+
+    int* keys   = malloc(size * sizeof(int));
+    int* values = malloc(lookups * sizeof(int));
+    if (size == 0 || keys == NULL || values == NULL) {
+        printf("Failed to allocate benchmark data\n");
+        free(keys);
+        free(values);
+        return;
+    }
+
+    // Only even values go in the tree, so odd values are always misses.
+    srand(42);
+    avltree_filter_t* filter = avltree_filter_new(NULL);
+    avltree_t* root          = NULL;
+    for (size_t i = 0; i < size; i++) {
+        keys[i] = (rand() % (size * 8)) * 2;
+        root    = avltree_filter_insert(filter, root, keys[i]);
+    }
+
+    printf("filter: %zu values, %zu lookups\n", size, lookups);
+    for (int churn = 0; churn <= 1; churn++) {
+        if (churn) {
+            for (size_t i = 0; i < size; i += 2) {
+                root    = avltree_filter_delete(filter, root, keys[i]);
+                keys[i] = (rand() % (size * 8)) * 2;
+                root    = avltree_filter_insert(filter, root, keys[i]);
+            }
+            printf("  after replacing half of the values:\n");
+        }
+
+        for (size_t m = 0; m < sizeof(miss_ratios) / sizeof(*miss_ratios); m++) {
+            size_t misses = 0;
+            for (size_t i = 0; i < lookups; i++) {
+                int miss  = rand() < miss_ratios[m] * ((double)RAND_MAX + 1);
+                values[i] = keys[rand() % size] + miss;
+                misses   += miss;
+            }
+
+            size_t found = 0;
+            double start = bench_now();
+            for (size_t i = 0; i < lookups; i++) {
+                found += avltree_search(root, values[i]) != NULL;
+            }
+            double plain_time = bench_now() - start;
+
+            size_t filtered_found = 0;
+            start                 = bench_now();
+            for (size_t i = 0; i < lookups; i++) {
+                filtered_found += avltree_filter_search(filter, root, values[i]) != NULL;
+            }
+            double filtered_time = bench_now() - start;
+
+            size_t false_positives = 0;
+            for (size_t i = 0; i < lookups; i++) {
+                false_positives += (values[i] & 1) && avltree_filter_contains(filter, values[i]);
+            }
+
+            printf("  %3.0f%% misses: search %6.2f Mops/s - filtered %6.2f Mops/s - false positives %.2f%% "
+                   "(found %zu/%zu)\n",
+                   miss_ratios[m] * 100, lookups / plain_time / 1e6, lookups / filtered_time / 1e6,
+                   misses ? 100.0 * false_positives / misses : 0.0, filtered_found, found);
+        }
+    }
+
+    avltree_filter_free(filter);
+    avltree_free(root);
+    free(keys);
+    free(values);
+}
+
+/**
+ * Push a value into a binary min-heap, the baseline for avltree_bench_queue.
+ */
+void avltree_bench_heap_push(int heap[], size_t* size, int value) {
+    size_t i = (*size)++;
+    for (; i > 0 && heap[(i - 1) / 2] > value; i = (i - 1) / 2) {
+        heap[i] = heap[(i - 1) / 2];
+    }
+    heap[i] = value;
+}
+
+/**
+ * Pop the smallest value from a binary min-heap, the baseline for avltree_bench_queue.
+ */
+int avltree_bench_heap_pop(int heap[], size_t* size) {
+    int top   = heap[0];
+    int value = heap[--(*size)];
+
+    size_t i = 0;
+    for (size_t child = 1; child < *size; child = 2 * i + 1) {
+        if (child + 1 < *size && heap[child + 1] < heap[child]) {
+            child++;
+        }
+        if (heap[child] >= value) {
+            break;
+        }
+        heap[i] = heap[child];
+        i       = child;
+    }
+    heap[i] = value;
+    return top;
+}
+
+/**
+ * Benchmark avltree_queue_t against a binary heap, filling them and draining
+ * them in order, then on a steady queue where every popped value is pushed
+ * back further ahead, like a deadline being rescheduled. Pops through the
+ * fast path are also compared with finding the smallest value and going
+ * through avltree_delete_multi.
+ *
+ * @param size the amount of values in the queue.
+ * @param holds the amount of pop and push pairs on the steady queue.
+ */
+void avltree_bench_queue(size_t size, size_t holds) {
+    int* values = malloc(size * sizeof(int));
+    int* heap   = malloc(size * sizeof(int));
+    if (size == 0 || values == NULL || heap == NULL) {
+        printf("Failed to allocate benchmark data\n");
+        free(values);
+        free(heap);
+        return;
+    }
+
+    srand(42);
+    for (size_t i = 0; i < size; i++) {
+        values[i] = rand() % (size * 4);
+    }
+
+    size_t heap_size = 0;
+    long heap_total  = 0;
+    double start     = bench_now();
+    for (size_t i = 0; i < size; i++) {
+        avltree_bench_heap_push(heap, &heap_size, values[i]);
+    }
+    double heap_fill = bench_now() - start;
+
+    start = bench_now();
+    for (size_t i = 0; i < holds; i++) {
+        int value   = avltree_bench_heap_pop(heap, &heap_size);
+        heap_total += value;
+        avltree_bench_heap_push(heap, &heap_size, value + rand() % 1024);
+    }
+    double heap_hold = bench_now() - start;
+
+    start = bench_now();
+    while (heap_size > 0) {
+        heap_total += avltree_bench_heap_pop(heap, &heap_size);
+    }
+    double heap_drain = bench_now() - start;
+
+    srand(42);
+    for (size_t i = 0; i < size; i++) {
+        values[i] = rand() % (size * 4);
+    }
+
+    avltree_queue_t* queue = avltree_queue_new();
+    long queue_total       = 0;
+    start                  = bench_now();
+    for (size_t i = 0; i < size; i++) {
+        avltree_queue_push(queue, values[i]);
+    }
+    double queue_fill = bench_now() - start;
+
+    int value;
+    start = bench_now();
+    for (size_t i = 0; i < holds; i++) {
+        avltree_queue_pop_min(queue, &value);
+        queue_total += value;
+        avltree_queue_push(queue, value + rand() % 1024);
+    }
+    double queue_hold = bench_now() - start;
+
+    start = bench_now();
+    while (avltree_queue_pop_min(queue, &value) == 0) {
+        queue_total += value;
+    }
+    double queue_drain = bench_now() - start;
+
+    avltree_t* root = NULL;
+    for (size_t i = 0; i < size; i++) {
+        root = root == NULL ? avltree_new_node(values[i]) : avltree_insert_multi(root, values[i]);
+    }
+
+    start = bench_now();
+    while (root != NULL) {
+        root = avltree_delete_multi(root, avltree_queue_extreme(root, SMALLEST)->content);
+    }
+    double generic_drain = bench_now() - start;
+
+    for (size_t i = 0; i < size; i++) {
+        avltree_queue_push(queue, values[i]);
+    }
+
+    size_t popped = 0;
+    start         = bench_now();
+    while (avltree_queue_pop_min(queue, &value) == 0) {
+        popped += 1 + (avltree_queue_pop_max(queue, &value) == 0);
+    }
+    double double_drain = bench_now() - start;
+
+    printf("queue: %zu values, %zu holds\n", size, holds);
+    printf("  binary heap:  fill %6.2f Mops/s - hold %6.2f Mops/s - drain %6.2f Mops/s\n", size / heap_fill / 1e6,
+           holds / heap_hold / 1e6, size / heap_drain / 1e6);
+    printf("  avltree:      fill %6.2f Mops/s - hold %6.2f Mops/s - drain %6.2f Mops/s - matches heap: %s\n",
+           size / queue_fill / 1e6, holds / queue_hold / 1e6, size / queue_drain / 1e6,
+           queue_total == heap_total ? "yes" : "no");
+    printf("  avltree drain through avltree_delete_multi %6.2f Mops/s - drain from both ends %6.2f Mops/s\n",
+           size / generic_drain / 1e6, popped / double_drain / 1e6);
+
+    avltree_queue_free(queue);
+    free(values);
+    free(heap);
+}
+
+/**
+ * Arguments for the writer threads of avltree_bench_sharded. Writers use
+ * either the sharded tree or the tree behind the global lock.
+ */
+typedef struct {
+    avltree_sharded_t* sharded;
+    avltree_t** root;
+    pthread_mutex_t* lock;
+    unsigned int seed;
+    size_t operations;
+    int range;
+} avltree_bench_writer_t;
+
+/**
+ * Writer thread for avltree_bench_sharded, every fourth write is a delete.
+ */
+void* avltree_bench_writer(void* arg) {
+    avltree_bench_writer_t* writer = arg;
+    for (size_t i = 0; i < writer->operations; i++) {
+        int value = rand_r(&writer->seed) % writer->range;
+
+        if (writer->sharded != NULL) {
+            if (i % 4 == 3) {
+                avltree_sharded_delete(writer->sharded, value);
+            } else {
+                avltree_sharded_insert(writer->sharded, value);
+            }
+            continue;
+        }
+
+        pthread_mutex_lock(writer->lock);
+        if (i % 4 == 3) {
+            *writer->root = avltree_delete(*writer->root, value);
+        } else {
+            *writer->root = *writer->root == NULL ? avltree_new_node(value) : avltree_insert(*writer->root, value);
+        }
+        pthread_mutex_unlock(writer->lock);
+    }
+    return NULL;
+}
+
+/**
+ * Run the provided amount of writes split across writer threads.
+ *
+ * @param writer the arguments shared by all writers, the seed is set for each one.
+ * @param threads the amount of writer threads.
+ * @param operations the total amount of writes.
+ * @return the time it took for all writers to be done, in seconds. Negative if a thread failed to start.
+ */
+double avltree_bench_writers(avltree_bench_writer_t writer, size_t threads, size_t operations) {
+    pthread_t ids[64];
+    avltree_bench_writer_t writers[64];
+    if (threads > 64) {
+        return -1;
+    }
+
+    double start   = bench_now();
+    size_t started = 0;
+    for (; started < threads; started++) {
+        writers[started]            = writer;
+        writers[started].seed       = 42 + started;
+        writers[started].operations = operations / threads;
+        if (pthread_create(&ids[started], NULL, avltree_bench_writer, &writers[started]) != 0) {
+            break;
+        }
+    }
+
+    for (size_t i = 0; i < started; i++) {
+        pthread_join(ids[i], NULL);
+    }
+    return started == threads ? bench_now() - start : -1;
+}
+
+typedef struct {
+    size_t count;
+    int last;
+    int sorted;
+} avltree_bench_scan_t;
+
+/**
+ * Visitor for avltree_sharded_scan, checking values come in strictly increasing order.
+ */
+void avltree_bench_scan_visit(int value, void* data) {
+    avltree_bench_scan_t* scan = data;
+    if (scan->count > 0 && value <= scan->last) {
+        scan->sorted = 0;
+    }
+    scan->last = value;
+    scan->count++;
+}
+
+/**
+ * Benchmark concurrent writes on a sharded tree against a single tree behind
+ * a global lock, from 1 to 64 writer threads.
+ *
+ * @param operations the total amount of writes for each run.
+ * @param shards the amount of shards for the sharded tree.
+ */
+void avltree_bench_sharded(size_t operations, size_t shards) {
+    printf("sharded writes: %zu operations, %zu shards, %ld CPUs\n", operations, shards, sysconf(_SC_NPROCESSORS_ONLN));
+
+    for (size_t threads = 1; threads <= 64; threads *= 2) {
+        pthread_mutex_t lock          = PTHREAD_MUTEX_INITIALIZER;
+        avltree_t* root               = NULL;
+        avltree_bench_writer_t writer = {NULL, &root, &lock, 0, 0, (int)operations};
+        double locked_time            = avltree_bench_writers(writer, threads, operations);
+        avltree_free(root);
+
+        avltree_sharded_t* sharded = avltree_sharded_new(shards);
+        if (sharded == NULL) {
+            printf("Failed to allocate benchmark data\n");
+            return;
+        }
+
+        writer.sharded      = sharded;
+        double sharded_time = avltree_bench_writers(writer, threads, operations);
+
+        avltree_bench_scan_t scan = {0, 0, 1};
+        double start              = bench_now();
+        avltree_sharded_scan(sharded, avltree_bench_scan_visit, &scan);
+        double scan_time = bench_now() - start;
+        avltree_sharded_free(sharded);
+
+        printf("  %2zu threads: global lock %.2f Mops/s, sharded %.2f Mops/s, scan of %zu values %.2f ms, "
+               "in order: %s\n",
+               threads, operations / locked_time / 1e6, operations / sharded_time / 1e6, scan.count, scan_time * 1e3,
+               scan.sorted ? "yes" : "no");
+    }
+}
+
+/**
+ * Run all benchmarks for the AVL tree.
+ *
+ * @return 0 on success.
+ */
+int avltree_run_benchmarks() {
+    printf("============================= Benchmarks =======================================\n");
+    avltree_bench_multiset(1000000, 64);
+    avltree_bench_multiset(1000000, 1024);
+    avltree_bench_search_batch(1 << 22, 1 << 22);
+    avltree_bench_range_aggregate(1 << 20, 1 << 8);
+    avltree_bench_journal(1 << 16);
+    avltree_bench_filter(1 << 20, 1 << 20);
+    avltree_bench_queue(1 << 20, 1 << 20);
+    avltree_bench_sharded(1 << 20, 64);
+    printf("================================================================================\n");
+    return 0;
+}
+
+/**
+ * Print a value, used to scan sharded trees in the examples.
+ */
+void avltree_print_value(int value, void* data) {
+    (void)data;
+    printf("%d ", value);
+}
+
+int main(int argc, char* argv[]) {
+    if (argc > 1 && strcmp(argv[1], "bench") == 0) {
+        return avltree_run_benchmarks();
+    }
+
+    printf("============================= Starting up ======================================\n");
+
+    avltree_t* root = avltree_new_node(10);
+    root            = avltree_insert(root, 5);
+    root            = avltree_insert(root, 15);
+    root            = avltree_insert(root, 3);
+    root            = avltree_insert(root, 8);
+    root            = avltree_insert(root, 20);
+
+    printf("Base tree:\n");
+    avltree_print(root);
+    printf("================================================================================\n");
+
+    printf("Insert node with value 24:\n");
+    root = avltree_insert(root, 24);
+
+    avltree_print(root);
+    printf("================================================================================\n");
+
+    printf("Delete node with value 20:\n");
+    root = avltree_delete(root, 20);
+
+    avltree_print(root);
+    printf("================================================================================\n");
+
+    printf("Search for an existing element:\n");
+    avltree_print(avltree_search(root, 5));
+    printf("================================================================================\n");
+
+    printf("Search for an element that has been deleted:\n");
+    avltree_print(avltree_search(root, 20));
+    printf("================================================================================\n");
+
+    printf("Search for 5, 20, 24 in a single batch:\n");
+    int batch_values[] = {5, 20, 24};
+    avltree_t* batch_results[3];
+    avltree_search_batch(root, batch_values, 3, batch_results);
+    for (int i = 0; i < 3; i++) {
+        printf("%d: %s\n", batch_values[i], batch_results[i] != NULL ? "found" : "not found");
+    }
+    printf("================================================================================\n");
+
+    printf("Balance factor for node 10: %u\n", avltree_get_balance_factor(avltree_search(root, 10)));
+    printf("================================================================================\n");
+
+    printf("Height of the tree: %u\n", root->height);
+    printf("================================================================================\n");
+
+    printf("Insert node 6 and 7 to force a LR rotation: \n");
+    root = avltree_insert(root, 6);
+    root = avltree_insert(root, 7);
+    avltree_print(root);
+    printf("================================================================================\n");
+
+    printf("Insert node 23 to force a RL rotation: \n");
+    root = avltree_insert(root, 23);
+    avltree_print(root);
+    printf("================================================================================\n");
+
+    printf("Remove the root of the tree for testing:\n");
+    root = avltree_delete(root, 10);
+
+    avltree_print(root);
+    printf("================================================================================\n");
+
+    printf("Remove a leaf of the tree for testing:\n");
+    root = avltree_delete(root, 3);
+
+    avltree_print(root);
+    printf("================================================================================\n");
+
+    printf("Insert 8 twice and 30 three times as a multiset:\n");
+    root = avltree_insert_multi(root, 8);
+    root = avltree_insert_multi(root, 8);
+    root = avltree_insert_multi(root, 30);
+    root = avltree_insert_multi(root, 30);
+    root = avltree_insert_multi(root, 30);
+    avltree_print(root);
+    printf("Count for 8: %llu - Count for 30: %llu - Count for 99: %llu\n", avltree_count(root, 8),
+           avltree_count(root, 30), avltree_count(root, 99));
+    printf("================================================================================\n");
+
+    printf("Remove one occurrence of 30 and all occurrences of 8:\n");
+    root = avltree_delete_multi(root, 30);
+    root = avltree_delete_multi(root, 8);
+    root = avltree_delete_multi(root, 8);
+    root = avltree_delete_multi(root, 8);
+    avltree_print(root);
+    printf("================================================================================\n");
+
+    printf("Journal inserts of 1 to 6 and the delete of 4, then replay them:\n");
+    const char* journal_path = "/tmp/avltree-demo";
+    avltree_journal_remove(journal_path);
+    avltree_journal_t* journal = avltree_journal_open(journal_path, 4);
+    avltree_t* journaled       = NULL;
+    for (int i = 1; i <= 6; i++) {
+        journaled = avltree_journal_insert(journal, journaled, i);
+    }
+    journaled = avltree_journal_delete(journal, journaled, 4);
+    avltree_journal_close(journal);
+    avltree_free(journaled);
+
+    avltree_journal_replay(journal_path, &journaled);
+    avltree_print(journaled);
+    printf("================================================================================\n");
+
+    printf("Compact the journal, insert 9 and replay again:\n");
+    journal = avltree_journal_open(journal_path, 4);
+    avltree_journal_compact(journal, journaled);
+    journaled = avltree_journal_insert(journal, journaled, 9);
+    avltree_journal_close(journal);
+    avltree_free(journaled);
+
+    avltree_journal_replay(journal_path, &journaled);
+    avltree_print(journaled);
+    printf("================================================================================\n");
+
+    printf("Tear the last record of the journal, reopen it, insert 10 to 12 and replay again:\n");
+    // The first bytes of a record, as left behind by a crash in the middle of a write.
+    const char torn_record[] = {AVLTREE_JOURNAL_INSERT, 7, 0};
+    char* torn_path          = avltree_journal_path(journal_path, ".journal");
+    FILE* torn_file          = torn_path != NULL ? fopen(torn_path, "ab") : NULL;
+    if (torn_file != NULL) {
+        fwrite(torn_record, 1, sizeof(torn_record), torn_file);
+        fclose(torn_file);
+    }
+    free(torn_path);
+
+    journal = avltree_journal_open(journal_path, 4);
+    for (int i = 10; i <= 12; i++) {
+        journaled = avltree_journal_insert(journal, journaled, i);
+    }
+    avltree_journal_close(journal);
+    avltree_free(journaled);
+
+    avltree_journal_replay(journal_path, &journaled);
+    avltree_print(journaled);
+    avltree_free(journaled);
+    avltree_journal_remove(journal_path);
+    printf("================================================================================\n");
+
+    printf("Search for 7, 99 and 1000 through a filter in front of the tree:\n");
+    avltree_filter_t* filter = avltree_filter_new(root);
+    int filter_values[]      = {7, 99, 1000};
+    for (int i = 0; i < 3; i++) {
+        printf("%d: %s, %s\n", filter_values[i],
+               avltree_filter_contains(filter, filter_values[i]) ? "may be in the tree" : "not in the filter",
+               avltree_filter_search(filter, root, filter_values[i]) != NULL ? "found" : "not found");
+    }
+
+    printf("Insert 7, already in the tree, 4096 times through the filter:\n");
+    size_t filter_count = filter->values;
+    for (int i = 0; i < 4096; i++) {
+        root = avltree_filter_insert(filter, root, 7);
+    }
+    printf("Values added to the filter: %zu before, %zu after\n", filter_count, filter->values);
+    avltree_filter_free(filter);
+    printf("================================================================================\n");
+
+    printf("Push 9, 4, 4, 15 and 1 into a queue, then pop from both ends:\n");
+    avltree_queue_t* queue = avltree_queue_new();
+    int queue_values[]     = {9, 4, 4, 15, 1};
+    for (int i = 0; i < 5; i++) {
+        avltree_queue_push(queue, queue_values[i]);
+    }
+    printf("Min: %d - Max: %d - Size: %zu\n", avltree_queue_peek_min(queue)->content,
+           avltree_queue_peek_max(queue)->content, queue->size);
+
+    int popped;
+    while (avltree_queue_pop_min(queue, &popped) == 0) {
+        printf("Popped min %d", popped);
+        if (avltree_queue_pop_max(queue, &popped) == 0) {
+            printf(" - popped max %d", popped);
+        }
+        printf("\n");
+    }
+    avltree_queue_free(queue);
+    printf("================================================================================\n");
+
+    printf("Insert values 1 to 12 into a tree with 4 shards, delete 5 and 8, then scan it in order:\n");
+    avltree_sharded_t* sharded = avltree_sharded_new(4);
+    for (int i = 12; i >= 1; i--) {
+        avltree_sharded_insert(sharded, i);
+    }
+    avltree_sharded_delete(sharded, 5);
+    avltree_sharded_delete(sharded, 8);
+
+    for (size_t i = 0; i < sharded->shards_size; i++) {
+        printf("Shard %zu: ", i);
+        avltree_iterator_t iterator;
+        const avltree_t* stack[64];
+        avltree_iterator_init(&iterator, sharded->shards[i].root, stack);
+
+        const avltree_t* node;
+        while ((node = avltree_iterator_next(&iterator)) != NULL) {
+            printf("%d ", node->content);
+        }
+        printf("\n");
+    }
+
+    printf("Scan: ");
+    avltree_sharded_scan(sharded, avltree_print_value, NULL);
+    printf("\nSearch for 7: %s - Search for 8: %s\n", avltree_sharded_search(sharded, 7) ? "found" : "not found",
+           avltree_sharded_search(sharded, 8) ? "found" : "not found");
+    avltree_sharded_free(sharded);
+    printf("================================================================================\n");
+
+#ifdef AVLTREE_AGGREGATE
+    avltree_aggregate_t aggregate = avltree_range_aggregate(root, 6, 24);
+    printf("Aggregate for values in [6, 24]: count %llu - sum %lld - min %d - max %d\n", aggregate.count, aggregate.sum,
+           aggregate.min, aggregate.max);
     printf("================================================================================\n");
+#endif
 
     avltree_free(root);
 
@@ -1,11 +1,19 @@
+#include <fcntl.h>
+#include <limits.h>
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
+#include <sys/stat.h>
+#include <sys/types.h>
+#include <sys/wait.h>
+#include <time.h>
+#include <unistd.h>
 
 typedef struct btree_s {
     struct btree_s* left;
     struct btree_s* right;
     int content;
+    unsigned int count;
 } btree_t;
 
 /**
@@ -21,6 +29,7 @@ btree_t* btree_new_node(int value) {
     }
 
     node->content = value;
+    node->count   = 1;
     return node;
 }
 
@@ -61,6 +70,95 @@ btree_t* btree_search(btree_t* tree, int value) {
     return btree_search(tree->right, value);
 }
 
+/**
+ * Amount of searches interleaved by btree_search_batch.
+ */
+#define BTREE_BATCH_GROUP 16
+
+/**
+ * Search for many values in a tree at once. Results are the same as calling
+ * btree_search for each value.
+ *
+ * Instead of walking the tree for one value at a time, a group of searches is
+ * advanced one level at a time in a round robin fashion. Every time a search
+ * moves to a child node, the node is prefetched, so by the time the search gets
+ * its turn again the node is likely in cache. This way the cache misses of the
+ * searches in the group overlap instead of leaving the CPU waiting on each one.
+ *
+ * @param tree a pointer to the root of the tree.
+ * @param values the integers to look for in the tree.
+ * @param values_size the amount of values.
+ * @param results where to store a pointer to the node holding each value, NULL if not found.
+ */
+void btree_search_batch(btree_t* tree, const int values[], size_t values_size, btree_t* results[]) {
+    btree_t* nodes[BTREE_BATCH_GROUP];
+    size_t indexes[BTREE_BATCH_GROUP];
+    size_t active = 0;
+    size_t next   = 0;
+
+    for (int i = 0; i < BTREE_BATCH_GROUP; i++) {
+        nodes[i]   = tree;
+        indexes[i] = next < values_size ? next++ : values_size;
+        active    += indexes[i] < values_size;
+    }
+
+    while (active > 0) {
+        for (int i = 0; i < BTREE_BATCH_GROUP; i++) {
+            if (indexes[i] == values_size) {
+                // Nothing left for this slot.
+                continue;
+            }
+
+            btree_t* node = nodes[i];
+            int value     = values[indexes[i]];
+            if (node == NULL || node->content == value) {
+                results[indexes[i]] = node;
+
+                // Start the next search on this slot.
+                nodes[i]   = tree;
+                indexes[i] = next < values_size ? next++ : values_size;
+                active    -= indexes[i] == values_size;
+                continue;
+            }
+
+            node = node->content > value ? node->left : node->right;
+            __builtin_prefetch(node);
+            nodes[i] = node;
+        }
+    }
+}
+
+/**
+ * Count the nodes in a tree.
+ *
+ * @param tree a pointer to the root of the tree.
+ * @return the amount of nodes allocated for the tree.
+ */
+size_t btree_count_nodes(const btree_t* tree) {
+    if (tree == NULL) {
+        return 0;
+    }
+
+    return 1 + btree_count_nodes(tree->left) + btree_count_nodes(tree->right);
+}
+
+/**
+ * Get the height of a tree, the amount of nodes in its longest branch.
+ *
+ * @param tree a pointer to the root of the tree.
+ * @return the height of the tree, 0 for an empty tree.
+ */
+unsigned int btree_get_height(const btree_t* tree) {
+    if (tree == NULL) {
+        return 0;
+    }
+
+    unsigned int right_depth = 1 + btree_get_height(tree->right);
+    unsigned int left_depth  = 1 + btree_get_height(tree->left);
+
+    return right_depth > left_depth ? right_depth : left_depth;
+}
+
 /**
  * Insert a new node into a tree with the value provided as its content.
  *
@@ -99,9 +197,13 @@ typedef enum {
  * This function is used as part of the process for deleting a node, the deleted
  * node will be replaced by the popped leaf. In order to reach the leaf, we can
  * tell the function to look for the leaf on the lower or higher values with the
- * bias argument. By popped leaf, we refer to a node on the lowest level of the
- * tree that is removed from the tree for the caller to use without the
- * possibility of the node to be pointed by multiple points in the tree.
+ * bias argument. By popped leaf, we refer to the smallest or biggest node under
+ * the provided node, which has at most one child. That child takes its place so
+ * the caller can use the popped node without the possibility of the node to be
+ * pointed by multiple points in the tree.
+ *
+ * If the provided node is itself the smallest or biggest one, it is returned
+ * as is and it is up to the caller to unlink it from its parent.
  *
  * @param node a pointer to a btree_t node where we will look for a leaf
  * @param bias a bias parameter for us to choose which branch should be preferred.
@@ -116,10 +218,10 @@ btree_t* btree_pop_leaf(btree_t* node, btree_pop_bias_t bias) {
 
     switch (bias) {
     case SMALLEST:
-        leaf = node->left != NULL ? node->left : node->right;
+        leaf = node->left;
         break;
     case BIGGEST:
-        leaf = node->right != NULL ? node->right : node->left;
+        leaf = node->right;
         break;
     default:
         printf("Programmer logic error, invalid btree pop bias\n");
@@ -127,22 +229,21 @@ btree_t* btree_pop_leaf(btree_t* node, btree_pop_bias_t bias) {
     }
 
     if (leaf == NULL) {
-        // The node itself was a leaf.
-        return NULL;
+        // The node itself is the one we are looking for.
+        return node;
     }
 
-    if (leaf->left != NULL || leaf->right != NULL) {
-        // The leaf is not actually a leaf, we need to go deeper.
-        return btree_pop_leaf(leaf, bias);
-    }
-
-    // We found the leaf, pop it from the tree and return it.
-    if (node->right == leaf) {
-        node->right = NULL;
-    } else {
-        node->left = NULL;
+    btree_t* retval = btree_pop_leaf(leaf, bias);
+    if (retval == leaf) {
+        // We found the leaf, pop it from the tree and return it.
+        if (bias == SMALLEST) {
+            node->left = leaf->right;
+        } else {
+            node->right = leaf->left;
+        }
+        leaf->left = leaf->right = NULL;
     }
-    return leaf;
+    return retval;
 }
 
 /**
@@ -161,14 +262,14 @@ btree_t* btree_replace_node(btree_t* node, btree_t* parent) {
     }
 
     btree_t* replacement_node;
-    if (node->left != NULL) {
-        replacement_node = btree_pop_leaf(node->left, BIGGEST);
+    if (node->left == NULL) {
+        // Nothing smaller than the node, its right branch can take its place.
+        replacement_node = node->right;
     } else {
-        replacement_node = btree_pop_leaf(node->right, SMALLEST);
-    }
-
-    if (replacement_node != NULL) {
-        replacement_node->left  = node->left;
+        replacement_node = btree_pop_leaf(node->left, BIGGEST);
+        if (replacement_node != node->left) {
+            replacement_node->left = node->left;
+        }
         replacement_node->right = node->right;
     }
 
@@ -227,104 +328,1343 @@ btree_t* btree_delete_inner(btree_t* node, btree_t* parent, int value) {
 #define btree_delete(tree, value) btree_delete_inner(tree, NULL, value)
 
 /**
- * Print a formatted node of a tree. This is an inner function and you should
- * use btree_print instead.
+ * Insert a value into a tree used as a multiset. If the value is already in the
+ * tree, its occurrence count is incremented instead of adding a new node, so
+ * memory scales with the amount of distinct values rather than insertions.
  *
- * @param tree a pointer to the current node to print.
- * @param pointy a string with the arrow that should be printed next to the node.
- * @param padding a string with the padding needed for the tree to look nice.
+ * Counts saturate at UINT_MAX, keeping the node as small as a plain one. A
+ * saturated count is no longer exact, so it stays at UINT_MAX from then on.
+ *
+ * @param tree a pointer to a btree_t node where the value will be inserted into.
+ * @param value an integer to be inserted in the tree.
  */
-void btree_print_inner(const btree_t* tree, const char* pointy, char padding[1024]) {
+void btree_insert_multi(btree_t* tree, int value) {
     if (tree == NULL) {
         return;
     }
 
-    printf("%s%d\n", pointy, tree->content);
-
-    if (tree->left == NULL && tree->right == NULL) {
+    if (tree->content == value) {
+        tree->count += tree->count < UINT_MAX;
         return;
     }
 
-    if (tree->left) {
-        printf("%s", padding);
-        strcat(padding, "|   ");
-        btree_print_inner(tree->left, "|-> ", padding);
-        padding[strlen(padding) - 4] = '\0';
+    btree_t** next = tree->content > value ? &tree->left : &tree->right;
+    if (*next == NULL) {
+        *next = btree_new_node(value);
     } else {
-        printf("%s%s\n", padding, "|-> ");
+        btree_insert_multi(*next, value);
     }
+}
 
-    if (tree->right) {
-        printf("%s", padding);
-        strcat(padding, "    ");
-        btree_print_inner(tree->right, "┗-> ", padding);
-        padding[strlen(padding) - 4] = '\0';
-    } else {
-        printf("%s%s\n", padding, "┗-> ");
+/**
+ * Remove one occurrence of a value from a tree used as a multiset. The node
+ * holding the value is only removed from the tree once its count reaches 0,
+ * a saturated count is left untouched.
+ *
+ * @param tree a pointer to the root of the tree to look for the value.
+ * @param value an integer we are looking for in the tree.
+ * @return a pointer to the root of the tree, needed if the root is the node to be removed.
+ */
+btree_t* btree_delete_multi(btree_t* tree, int value) {
+    btree_t* node = btree_search(tree, value);
+    if (node == NULL) {
+        return tree;
+    }
+
+    if (node->count > 1) {
+        node->count -= node->count < UINT_MAX;
+        return tree;
     }
+
+    return btree_delete(tree, value);
 }
 
 /**
- * Print a tree in a nice way.
+ * Get the amount of times a value is present in a tree used as a multiset.
  *
- * @param tree a pointer to the tree to be printed.
+ * @param tree a pointer to the root of the tree to look for the value.
+ * @param value an integer we are looking for in the tree.
+ * @return the occurrence count for the value, 0 if it is not in the tree, UINT_MAX if it saturated.
  */
-void btree_print(const btree_t* tree) {
-    char padding[1024] = {0};
+unsigned int btree_count(btree_t* tree, int value) {
+    btree_t* node = btree_search(tree, value);
+    return node != NULL ? node->count : 0;
+}
+
+/**
+ * This is an inner function, it links the nodes of a tree in order in front of
+ * a list, using their right pointers as the next pointer of the list.
+ *
+ * @param node a pointer to the root of the tree to be flattened.
+ * @param head a pointer to the list the nodes will be put in front of.
+ * @return a pointer to the new head of the list.
+ */
+btree_t* btree_flatten(btree_t* node, btree_t* head) {
+    if (node == NULL) {
+        return head;
+    }
+
+    node->right   = btree_flatten(node->right, head);
+    btree_t* left = node->left;
+    node->left    = NULL;
+    return btree_flatten(left, node);
+}
+
+/**
+ * This is an inner function, it takes the first nodes of a list created by
+ * btree_flatten and links them into a perfectly balanced tree.
+ *
+ * @param list a pointer to the head of the list, it is moved past the used nodes.
+ * @param size the amount of nodes to take from the list.
+ * @return a pointer to the root of the new tree.
+ */
+btree_t* btree_build(btree_t** list, size_t size) {
+    if (size == 0) {
+        return NULL;
+    }
+
+    btree_t* left = btree_build(list, (size - 1) / 2);
+    btree_t* root = *list;
+    *list         = root->right;
+    root->left    = left;
+    root->right   = btree_build(list, size - 1 - (size - 1) / 2);
+    return root;
+}
+
+/**
+ * Rebuild a tree into a perfectly balanced one. No memory is allocated, the
+ * existing nodes are relinked in place.
+ *
+ * @param tree a pointer to the root of the tree to be rebuilt.
+ * @param size the amount of nodes in the tree.
+ * @return a pointer to the new root of the tree.
+ */
+btree_t* btree_rebuild(btree_t* tree, size_t size) {
+    btree_t* list = btree_flatten(tree, NULL);
+    return btree_build(&list, size);
+}
+
+/**
+ * A binary tree kept balanced as a scapegoat tree. Nodes are regular btree_t
+ * nodes, the only bookkeeping needed is the amount of nodes in the tree and
+ * the biggest amount it had since it was last fully rebuilt.
+ *
+ * With alpha being BTREE_SCAPEGOAT_ALPHA, no node is deeper than
+ * log(size) / log(1 / alpha), so searches are O(log n) in the worst case and
+ * updates are O(log n) amortized, even when values are inserted in order.
+ */
+typedef struct {
+    btree_t* root;
+    size_t size;
+    size_t max_size;
+} btree_scapegoat_t;
+
+/**
+ * Balance factor for scapegoat trees. A subtree is considered unbalanced when
+ * one of its branches holds more than this fraction of its nodes.
+ */
+#define BTREE_SCAPEGOAT_ALPHA (2.0 / 3.0)
+
+/**
+ * Create a new empty scapegoat tree.
+ *
+ * @return a pointer to the new tree. Null if we fail to allocate memory.
+ */
+btree_scapegoat_t* btree_scapegoat_new() {
+    return calloc(1, sizeof(btree_scapegoat_t));
+}
+
+/**
+ * Free a scapegoat tree and all of its nodes.
+ *
+ * @param tree a pointer to the scapegoat tree.
+ */
+void btree_scapegoat_free(btree_scapegoat_t* tree) {
     if (tree == NULL) {
         return;
     }
 
-    btree_print_inner(tree, "", padding);
+    btree_free(tree->root);
+    free(tree);
 }
 
-int main(int argc, char* argv[]) {
-    printf("============================= Starting up ======================================\n");
+/**
+ * Get the deepest a node can be in a scapegoat tree before it needs rebuilding.
+ *
+ * @param size the amount of nodes in the tree.
+ * @return the biggest integer not greater than log(size) / log(1 / alpha).
+ */
+unsigned int btree_scapegoat_max_depth(size_t size) {
+    unsigned int depth = 0;
+    double bound       = 1 / BTREE_SCAPEGOAT_ALPHA;
+    while (bound <= size) {
+        bound /= BTREE_SCAPEGOAT_ALPHA;
+        depth++;
+    }
+    return depth;
+}
 
-    btree_t* root = btree_new_node(8);
-    btree_insert(root, 3);
-    btree_insert(root, 10);
-    btree_insert(root, 1);
-    btree_insert(root, 6);
-    btree_insert(root, 4);
-    btree_insert(root, 7);
-    btree_insert(root, 14);
-    btree_insert(root, 13);
-    btree_insert(root, 20);
+/**
+ * Inner function used for inserting nodes into a scapegoat tree recursively.
+ * If the new node ends up too deep, the sizes of the subtrees on the path to it
+ * are computed on the way back, and the first one found to be unbalanced, the
+ * scapegoat, is rebuilt.
+ *
+ * @param slot a pointer to the pointer to the current node in its parent.
+ * @param value an integer to be used as the content for a new node.
+ * @param depth the depth of the current node.
+ * @param max_depth the deepest a node can be without rebuilding.
+ * @param inserted set to 1 if a new node is added to the tree.
+ * @return the size of the current subtree if a scapegoat is still needed, 0 otherwise.
+ */
+size_t btree_scapegoat_insert_inner(btree_t** slot, int value, unsigned int depth, unsigned int max_depth,
+                                    int* inserted) {
+    btree_t* node = *slot;
+    if (node == NULL) {
+        *slot     = btree_new_node(value);
+        *inserted = *slot != NULL;
+        return *inserted && depth > max_depth ? 1 : 0;
+    }
 
-    printf("Base tree:\n");
-    btree_print(root);
-    printf("================================================================================\n");
+    if (node->content == value) {
+        return 0;
+    }
 
-    printf("Insert nodes with values 24 and 5:\n");
-    btree_insert(root, 24);
-    btree_insert(root, 5);
+    btree_t** child  = node->content > value ? &node->left : &node->right;
+    btree_t* sibling = node->content > value ? node->right : node->left;
 
-    btree_print(root);
-    printf("================================================================================\n");
+    size_t child_size = btree_scapegoat_insert_inner(child, value, depth + 1, max_depth, inserted);
+    if (child_size == 0) {
+        return 0;
+    }
 
-    printf("Delete nodes with values 6 and 10:\n");
-    root = btree_delete(root, 6);
-    root = btree_delete(root, 10);
+    size_t size = 1 + child_size + btree_count_nodes(sibling);
+    if (child_size > BTREE_SCAPEGOAT_ALPHA * size) {
+        *slot = btree_rebuild(node, size);
+        return 0;
+    }
+    return size;
+}
 
-    btree_print(root);
-    printf("================================================================================\n");
+/**
+ * Insert a new node into a scapegoat tree with the value provided as its
+ * content.
+ *
+ * @param tree a pointer to the scapegoat tree.
+ * @param value an integer to be used as the content for a new node.
+ */
+void btree_scapegoat_insert(btree_scapegoat_t* tree, int value) {
+    if (tree == NULL) {
+        return;
+    }
 
-    printf("Remove the root of the tree for testing:\n");
-    root = btree_delete(root, 8);
+    int inserted = 0;
+    btree_scapegoat_insert_inner(&tree->root, value, 0, btree_scapegoat_max_depth(tree->size + 1), &inserted);
+    if (inserted) {
+        tree->size++;
+        if (tree->size > tree->max_size) {
+            tree->max_size = tree->size;
+        }
+    }
+}
 
-    btree_print(root);
-    printf("================================================================================\n");
+/**
+ * Remove the node holding the provided value from a scapegoat tree. Once the
+ * tree shrinks below alpha times its biggest size, it is fully rebuilt.
+ *
+ * @param tree a pointer to the scapegoat tree.
+ * @param value an integer we are looking for in the tree.
+ */
+void btree_scapegoat_delete(btree_scapegoat_t* tree, int value) {
+    if (tree == NULL || btree_search(tree->root, value) == NULL) {
+        return;
+    }
 
-    printf("Search for an existing element:\n");
-    btree_print(btree_search(root, 5));
-    printf("================================================================================\n");
+    tree->root = btree_delete(tree->root, value);
+    tree->size--;
 
-    printf("Search for an element that has been deleted:\n");
-    btree_print(btree_search(root, 10));
-    printf("================================================================================\n");
+    if (tree->size < BTREE_SCAPEGOAT_ALPHA * tree->max_size) {
+        tree->root     = btree_rebuild(tree->root, tree->size);
+        tree->max_size = tree->size;
+    }
+}
 
-    btree_free(root);
+/**
+ * Search for a node containing the provided value in a scapegoat tree.
+ *
+ * @param tree a pointer to the scapegoat tree.
+ * @param value an integer to look for in the tree
+ * @return a pointer to the node holding the value if found, NULL otherwise.
+ */
+btree_t* btree_scapegoat_search(btree_scapegoat_t* tree, int value) {
+    return tree != NULL ? btree_search(tree->root, value) : NULL;
+}
+
+/**
+ * Create a perfectly balanced tree holding the provided values. This is the
+ * fast path for loading many values at once, taking O(n) instead of inserting
+ * them one at a time.
+ *
+ * @param values a sorted array of integers, without duplicates.
+ * @param size the amount of values.
+ * @return a pointer to the root of the new tree, NULL if there are no values.
+ */
+btree_t* btree_from_sorted(const int values[], size_t size) {
+    if (size == 0) {
+        return NULL;
+    }
+
+    size_t middle = size / 2;
+    btree_t* node = btree_new_node(values[middle]);
+    if (node == NULL) {
+        return NULL;
+    }
+
+    node->left  = btree_from_sorted(values, middle);
+    node->right = btree_from_sorted(values + middle + 1, size - middle - 1);
+    return node;
+}
+
+/**
+ * Operations recorded in a journal. Each record is the operation as a single
+ * byte followed by the value, as an int in native byte order.
+ */
+#define BTREE_JOURNAL_INSERT 'I'
+#define BTREE_JOURNAL_DELETE 'D'
+#define BTREE_JOURNAL_RECORD_SIZE (1 + sizeof(int))
+
+/**
+ * A write-ahead journal for the changes done to a tree.
+ *
+ * For a journal at path, the files used are:
+ *   path.journal: records for the changes since the last compaction.
+ *   path.journal.old: records being compacted, only present during a compaction.
+ *   path.snapshot: the values in the tree at the last compaction, sorted.
+ */
+typedef struct {
+    char* path;
+    FILE* file;
+    unsigned int commit_interval;
+    unsigned int pending;
+    pid_t compaction;
+} btree_journal_t;
+
+/**
+ * Get the path for one of the files of a journal.
+ *
+ * @param path the path the journal was opened with.
+ * @param suffix the suffix for the file.
+ * @return a newly allocated string with the path, NULL if we fail to allocate memory.
+ */
+char* btree_journal_path(const char* path, const char* suffix) {
+    char* full_path = malloc(strlen(path) + strlen(suffix) + 1);
+    if (full_path == NULL) {
+        return NULL;
+    }
+
+    strcpy(full_path, path);
+    strcat(full_path, suffix);
+    return full_path;
+}
+
+/**
+ * This is an inner function, it drops a record cut short by a crash at the end
+ * of a journal file, so the records appended after it stay aligned.
+ *
+ * @param file the journal file, opened for appending.
+ * @return 0 on success, -1 otherwise.
+ */
+int btree_journal_trim(FILE* file) {
+    struct stat info;
+    if (fstat(fileno(file), &info) != 0) {
+        return -1;
+    }
+
+    off_t torn = info.st_size % BTREE_JOURNAL_RECORD_SIZE;
+    return torn == 0 ? 0 : ftruncate(fileno(file), info.st_size - torn);
+}
+
+/**
+ * Open a journal for appending records, creating it if needed.
+ *
+ * Records are written to disk in groups: the journal is only synced once every
+ * commit_interval records, trading the amount of changes that can be lost on a
+ * crash for throughput.
+ *
+ * @param path the base path for the journal files.
+ * @param commit_interval the amount of records per sync, 0 to only sync on commit and close.
+ * @return a pointer to the journal, NULL if it could not be opened.
+ */
+btree_journal_t* btree_journal_open(const char* path, unsigned int commit_interval) {
+    btree_journal_t* journal = calloc(1, sizeof(btree_journal_t));
+    if (journal == NULL) {
+        return NULL;
+    }
+
+    journal->path            = strdup(path);
+    journal->commit_interval = commit_interval;
+
+    char* journal_path = journal->path != NULL ? btree_journal_path(path, ".journal") : NULL;
+    if (journal_path != NULL) {
+        journal->file = fopen(journal_path, "ab");
+    }
+    free(journal_path);
+
+    if (journal->file != NULL && btree_journal_trim(journal->file) != 0) {
+        fclose(journal->file);
+        journal->file = NULL;
+    }
+    if (journal->file == NULL) {
+        printf("Failed to open journal at %s\n", path);
+        free(journal->path);
+        free(journal);
+        return NULL;
+    }
+
+    return journal;
+}
+
+/**
+ * Sync all pending records of a journal to disk.
+ *
+ * @param journal a pointer to the journal.
+ * @return 0 on success, -1 otherwise.
+ */
+int btree_journal_commit(btree_journal_t* journal) {
+    if (journal->pending == 0) {
+        return 0;
+    }
+
+    if (fflush(journal->file) != 0 || fsync(fileno(journal->file)) != 0) {
+        return -1;
+    }
+
+    journal->pending = 0;
+    return 0;
+}
+
+/**
+ * Append a record to a journal, syncing it to disk if the commit interval is
+ * reached.
+ *
+ * @param journal a pointer to the journal.
+ * @param operation the operation being recorded.
+ * @param value the value the operation is done with.
+ * @return 0 on success, -1 otherwise.
+ */
+int btree_journal_append(btree_journal_t* journal, char operation, int value) {
+    if (fwrite(&operation, 1, 1, journal->file) != 1 || fwrite(&value, sizeof(int), 1, journal->file) != 1) {
+        return -1;
+    }
+
+    journal->pending++;
+    if (journal->commit_interval != 0 && journal->pending >= journal->commit_interval) {
+        return btree_journal_commit(journal);
+    }
+    return 0;
+}
+
+/**
+ * Insert a value into a tree, recording it in a journal first.
+ *
+ * @param journal a pointer to the journal, NULL to skip journaling.
+ * @param tree a pointer to the root of the tree, NULL for an empty tree.
+ * @param value an integer to be used as the content for a new node.
+ * @return a pointer to the root of the tree.
+ */
+btree_t* btree_journal_insert(btree_journal_t* journal, btree_t* tree, int value) {
+    if (journal != NULL && btree_journal_append(journal, BTREE_JOURNAL_INSERT, value) != 0) {
+        printf("Failed to write to the journal, %d was not inserted\n", value);
+        return tree;
+    }
+
+    if (tree == NULL) {
+        return btree_new_node(value);
+    }
+
+    btree_insert(tree, value);
+    return tree;
+}
+
+/**
+ * Delete a value from a tree, recording it in a journal first.
+ *
+ * @param journal a pointer to the journal, NULL to skip journaling.
+ * @param tree a pointer to the root of the tree.
+ * @param value an integer we are looking for in the tree.
+ * @return a pointer to the root of the tree, needed if the root is the node to be removed.
+ */
+btree_t* btree_journal_delete(btree_journal_t* journal, btree_t* tree, int value) {
+    if (journal != NULL && btree_journal_append(journal, BTREE_JOURNAL_DELETE, value) != 0) {
+        printf("Failed to write to the journal, %d was not deleted\n", value);
+        return tree;
+    }
+
+    return btree_delete(tree, value);
+}
+
+/**
+ * This is an inner function, it writes the values of a tree in order.
+ *
+ * @param tree a pointer to the current node.
+ * @param file the file to write to.
+ * @return 0 on success, -1 otherwise.
+ */
+int btree_journal_write_values(const btree_t* tree, FILE* file) {
+    if (tree == NULL) {
+        return 0;
+    }
+
+    if (btree_journal_write_values(tree->left, file) != 0 || fwrite(&tree->content, sizeof(int), 1, file) != 1) {
+        return -1;
+    }
+    return btree_journal_write_values(tree->right, file);
+}
+
+/**
+ * This is an inner function, it syncs the directory holding a file to disk so
+ * a rename into it survives a crash.
+ *
+ * @param path the path of the file.
+ * @return 0 on success, -1 otherwise.
+ */
+int btree_journal_sync_directory(const char* path) {
+    const char* slash = strrchr(path, '/');
+    char* directory   = slash == NULL ? strdup(".") : strndup(path, slash == path ? 1 : slash - path);
+    int fd            = directory != NULL ? open(directory, O_RDONLY | O_DIRECTORY) : -1;
+    free(directory);
+    if (fd < 0) {
+        return -1;
+    }
+
+    int result = fsync(fd);
+    close(fd);
+    return result;
+}
+
+/**
+ * Write a snapshot of a tree and drop the records it makes redundant. The
+ * snapshot is written to a temporary file and renamed once it is on disk, so
+ * a crash leaves either the previous snapshot or the new one. The records are
+ * only dropped once the rename itself is on disk.
+ *
+ * @param path the base path for the journal files.
+ * @param tree a pointer to the root of the tree.
+ * @return 0 on success, -1 otherwise.
+ */
+int btree_journal_write_snapshot(const char* path, const btree_t* tree) {
+    char* tmp_path      = btree_journal_path(path, ".snapshot.tmp");
+    char* snapshot_path = btree_journal_path(path, ".snapshot");
+    char* old_path      = btree_journal_path(path, ".journal.old");
+    int result          = -1;
+
+    FILE* file = tmp_path != NULL ? fopen(tmp_path, "wb") : NULL;
+    if (file != NULL) {
+        result = btree_journal_write_values(tree, file);
+        if (fflush(file) != 0 || fsync(fileno(file)) != 0) {
+            result = -1;
+        }
+        fclose(file);
+    }
+
+    if (result == 0 && snapshot_path != NULL && old_path != NULL && rename(tmp_path, snapshot_path) == 0 &&
+        btree_journal_sync_directory(snapshot_path) == 0) {
+        unlink(old_path);
+    } else {
+        result = -1;
+    }
+
+    free(tmp_path);
+    free(snapshot_path);
+    free(old_path);
+    return result;
+}
+
+/**
+ * Wait for the compaction of a journal to be done, if there is one running.
+ *
+ * @param journal a pointer to the journal.
+ * @return 0 if the compaction succeeded or there was none, -1 otherwise.
+ */
+int btree_journal_wait(btree_journal_t* journal) {
+    if (journal->compaction <= 0) {
+        return 0;
+    }
+
+    int status = 0;
+    waitpid(journal->compaction, &status, 0);
+    journal->compaction = 0;
+    return WIFEXITED(status) && WEXITSTATUS(status) == 0 ? 0 : -1;
+}
+
+/**
+ * This is an inner function, it moves the records in the journal file to the
+ * file with the records being compacted. If a previous compaction failed, the
+ * records are appended to the ones it left behind so none of them are lost,
+ * after dropping a record cut short at their end.
+ *
+ * @param journal_path the path of the journal file.
+ * @param old_path the path of the file with the records being compacted.
+ * @return 0 on success, -1 otherwise.
+ */
+int btree_journal_rotate(const char* journal_path, const char* old_path) {
+    if (access(old_path, F_OK) != 0) {
+        return rename(journal_path, old_path);
+    }
+
+    FILE* from = fopen(journal_path, "rb");
+    FILE* to   = fopen(old_path, "ab");
+    int result = from != NULL && to != NULL && btree_journal_trim(to) == 0 ? 0 : -1;
+
+    char buffer[4096];
+    size_t read;
+    while (result == 0 && (read = fread(buffer, 1, sizeof(buffer), from)) > 0) {
+        result = fwrite(buffer, 1, read, to) == read ? 0 : -1;
+    }
+
+    if (to != NULL && (fflush(to) != 0 || fsync(fileno(to)) != 0)) {
+        result = -1;
+    }
+    if (from != NULL) {
+        fclose(from);
+    }
+    if (to != NULL) {
+        fclose(to);
+    }
+    return result == 0 ? unlink(journal_path) : -1;
+}
+
+/**
+ * Compact a journal into a sorted snapshot of the tree, in the background.
+ *
+ * The current records are set aside and a new journal is started, then a
+ * child process writes the snapshot from its copy of the tree while the caller
+ * keeps working on the tree. Only one compaction runs at a time, starting a
+ * new one waits for the previous one to be done.
+ *
+ * @param journal a pointer to the journal.
+ * @param tree a pointer to the root of the tree the journal is recording.
+ * @return 0 if the compaction was started, -1 otherwise.
+ */
+int btree_journal_compact(btree_journal_t* journal, const btree_t* tree) {
+    btree_journal_wait(journal);
+
+    if (btree_journal_commit(journal) != 0) {
+        return -1;
+    }
+
+    char* journal_path = btree_journal_path(journal->path, ".journal");
+    char* old_path     = btree_journal_path(journal->path, ".journal.old");
+    int result         = -1;
+    if (journal_path != NULL && old_path != NULL) {
+        fclose(journal->file);
+        result        = btree_journal_rotate(journal_path, old_path);
+        journal->file = fopen(journal_path, "ab");
+    }
+    free(journal_path);
+    free(old_path);
+
+    if (journal->file == NULL) {
+        printf("Failed to reopen journal at %s\n", journal->path);
+        return -1;
+    }
+    if (result != 0) {
+        return -1;
+    }
+
+    fflush(stdout);
+    pid_t pid = fork();
+    if (pid == 0) {
+        _exit(btree_journal_write_snapshot(journal->path, tree) == 0 ? 0 : 1);
+    } else if (pid < 0) {
+        // No child to do it in the background, do it ourselves.
+        return btree_journal_write_snapshot(journal->path, tree);
+    }
+
+    journal->compaction = pid;
+    return 0;
+}
+
+/**
+ * Close a journal, syncing any pending records and waiting for a running
+ * compaction to be done.
+ *
+ * @param journal a pointer to the journal.
+ */
+void btree_journal_close(btree_journal_t* journal) {
+    if (journal == NULL) {
+        return;
+    }
+
+    btree_journal_commit(journal);
+    btree_journal_wait(journal);
+    fclose(journal->file);
+    free(journal->path);
+    free(journal);
+}
+
+/**
+ * Remove all the files of a journal.
+ *
+ * @param path the base path for the journal files.
+ */
+void btree_journal_remove(const char* path) {
+    const char* suffixes[] = {".journal", ".journal.old", ".snapshot", ".snapshot.tmp"};
+    for (size_t i = 0; i < sizeof(suffixes) / sizeof(suffixes[0]); i++) {
+        char* file_path = btree_journal_path(path, suffixes[i]);
+        if (file_path != NULL) {
+            unlink(file_path);
+        }
+        free(file_path);
+    }
+}
+
+/**
+ * This is an inner function, it appends the contents of a file to a buffer.
+ *
+ * @param path the path of the file to read, a missing file is read as empty.
+ * @param buffer a pointer to the buffer, reallocated to fit the file.
+ * @param size a pointer to the size of the buffer, updated after reading.
+ * @return 0 on success, -1 otherwise.
+ */
+int btree_journal_read(const char* path, char** buffer, size_t* size) {
+    FILE* file = path != NULL ? fopen(path, "rb") : NULL;
+    if (file == NULL) {
+        return path != NULL ? 0 : -1;
+    }
+
+    int result = 0;
+    char chunk[4096];
+    size_t read;
+    while ((read = fread(chunk, 1, sizeof(chunk), file)) > 0) {
+        char* grown = realloc(*buffer, *size + read);
+        if (grown == NULL) {
+            result = -1;
+            break;
+        }
+
+        memcpy(grown + *size, chunk, read);
+        *buffer = grown;
+        *size += read;
+    }
+
+    fclose(file);
+    return result;
+}
+
+typedef struct {
+    int value;
+    char operation;
+    size_t sequence;
+} btree_journal_record_t;
+
+/**
+ * Compare two journal records by value and then by the order they were
+ * written in, to be used with qsort.
+ */
+int btree_journal_compare_records(const void* a, const void* b) {
+    const btree_journal_record_t* x = a;
+    const btree_journal_record_t* y = b;
+    if (x->value != y->value) {
+        return x->value < y->value ? -1 : 1;
+    }
+    return (x->sequence > y->sequence) - (x->sequence < y->sequence);
+}
+
+/**
+ * This is an inner function, it parses the records of a journal file, ignoring
+ * a record cut short by a crash at its end.
+ *
+ * @param log the contents of the journal file.
+ * @param log_size the size of the contents.
+ * @param records the array to append the records to, numbered after the ones already in it.
+ * @param records_size a pointer to the amount of records in the array, updated after parsing.
+ */
+void btree_journal_parse(const char* log, size_t log_size, btree_journal_record_t* records, size_t* records_size) {
+    for (size_t i = 0; i < log_size / BTREE_JOURNAL_RECORD_SIZE; i++) {
+        btree_journal_record_t* record = &records[(*records_size)++];
+        record->operation              = log[i * BTREE_JOURNAL_RECORD_SIZE];
+        record->sequence               = *records_size;
+        memcpy(&record->value, log + i * BTREE_JOURNAL_RECORD_SIZE + 1, sizeof(int));
+    }
+}
+
+/**
+ * Rebuild a tree from the files of a journal.
+ *
+ * Instead of replaying the records one by one, they are sorted by value so
+ * the last record for each value decides whether it is in the tree. These are
+ * merged with the sorted snapshot and the tree is built at once with
+ * btree_from_sorted.
+ *
+ * A record cut short by a crash at the end of either journal file is ignored.
+ *
+ * @param path the base path for the journal files.
+ * @param tree set to a pointer to the root of the rebuilt tree, NULL if it is empty.
+ * @return 0 on success, -1 if the files could not be read.
+ */
+int btree_journal_replay(const char* path, btree_t** tree) {
+    char* snapshot_path = btree_journal_path(path, ".snapshot");
+    char* old_path      = btree_journal_path(path, ".journal.old");
+    char* journal_path  = btree_journal_path(path, ".journal");
+
+    char* snapshot       = NULL;
+    size_t snapshot_size = 0;
+    char* old_log        = NULL;
+    size_t old_log_size  = 0;
+    char* log            = NULL;
+    size_t log_size      = 0;
+    int result           = btree_journal_read(snapshot_path, &snapshot, &snapshot_size);
+    if (result == 0) {
+        result = btree_journal_read(old_path, &old_log, &old_log_size);
+    }
+    if (result == 0) {
+        result = btree_journal_read(journal_path, &log, &log_size);
+    }
+    free(snapshot_path);
+    free(old_path);
+    free(journal_path);
+
+    // Each file may end in a record cut short, so they are parsed on their own.
+    size_t values_size              = snapshot_size / sizeof(int);
+    size_t records_size             = old_log_size / BTREE_JOURNAL_RECORD_SIZE + log_size / BTREE_JOURNAL_RECORD_SIZE;
+    const int* values               = (const int*)snapshot;
+    btree_journal_record_t* records = malloc((records_size + 1) * sizeof(btree_journal_record_t));
+    int* merged                     = malloc((values_size + records_size + 1) * sizeof(int));
+    if (result != 0 || records == NULL || merged == NULL) {
+        free(snapshot);
+        free(old_log);
+        free(log);
+        free(records);
+        free(merged);
+        return -1;
+    }
+
+    records_size = 0;
+    btree_journal_parse(old_log, old_log_size, records, &records_size);
+    btree_journal_parse(log, log_size, records, &records_size);
+    qsort(records, records_size, sizeof(btree_journal_record_t), btree_journal_compare_records);
+
+    size_t merged_size = 0;
+    size_t i           = 0;
+    size_t j           = 0;
+    while (i < values_size || j < records_size) {
+        if (j == records_size || (i < values_size && values[i] < records[j].value)) {
+            merged[merged_size++] = values[i++];
+            continue;
+        }
+
+        // The last record for a value overrides the snapshot.
+        int value = records[j].value;
+        while (j + 1 < records_size && records[j + 1].value == value) {
+            j++;
+        }
+        if (records[j].operation == BTREE_JOURNAL_INSERT) {
+            merged[merged_size++] = value;
+        }
+        j++;
+
+        if (i < values_size && values[i] == value) {
+            i++;
+        }
+    }
+
+    *tree = btree_from_sorted(merged, merged_size);
+
+    free(snapshot);
+    free(old_log);
+    free(log);
+    free(records);
+    free(merged);
+    return 0;
+}
+
+/**
+ * Print a formatted node of a tree. This is an inner function and you should
+ * use btree_print instead.
+ *
+ * @param tree a pointer to the current node to print.
+ * @param pointy a string with the arrow that should be printed next to the node.
+ * @param padding a string with the padding needed for the tree to look nice.
+ */
+void btree_print_inner(const btree_t* tree, const char* pointy, char padding[1024]) {
+    if (tree == NULL) {
+        return;
+    }
+
+    if (tree->count > 1) {
+        printf("%s%d (x%u)\n", pointy, tree->content, tree->count);
+    } else {
+        printf("%s%d\n", pointy, tree->content);
+    }
+
+    if (tree->left == NULL && tree->right == NULL) {
+        return;
+    }
+
+    if (tree->left) {
+        printf("%s", padding);
+        strcat(padding, "|   ");
+        btree_print_inner(tree->left, "|-> ", padding);
+        padding[strlen(padding) - 4] = '\0';
+    } else {
+        printf("%s%s\n", padding, "|-> ");
+    }
+
+    if (tree->right) {
+        printf("%s", padding);
+        strcat(padding, "    ");
+        btree_print_inner(tree->right, "┗-> ", padding);
+        padding[strlen(padding) - 4] = '\0';
+    } else {
+        printf("%s%s\n", padding, "┗-> ");
+    }
+}
+
+/**
+ * Print a tree in a nice way.
+ *
+ * @param tree a pointer to the tree to be printed.
+ */
+void btree_print(const btree_t* tree) {
+    char padding[1024] = {0};
+    if (tree == NULL) {
+        return;
+    }
+
+    btree_print_inner(tree, "", padding);
+}
+
+/**
+ * Get a monotonic timestamp, used for measuring elapsed time in benchmarks.
+ *
+ * @return the current time in seconds.
+ */
+double bench_now() {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+/**
+ * Benchmark the multiset mode on a stream with a high amount of duplicates.
+ *
+ * @param events the amount of values in the stream.
+ * @param distinct the amount of distinct values in the stream.
+ */
+void btree_bench_multiset(size_t events, int distinct) {
+    int* stream = events > 0 ? malloc(events * sizeof(int)) : NULL;
+    if (stream == NULL) {
+        printf("Failed to allocate benchmark stream\n");
+        return;
+    }
+
+    srand(42);
+    for (size_t i = 0; i < events; i++) {
+        stream[i] = rand() % distinct;
+    }
+
+    double start  = bench_now();
+    btree_t* root = btree_new_node(stream[0]);
+    for (size_t i = 1; i < events; i++) {
+        btree_insert_multi(root, stream[i]);
+    }
+    double insert_time = bench_now() - start;
+
+    unsigned long long total = 0;
+    for (int i = 0; i < distinct; i++) {
+        total += btree_count(root, i);
+    }
+
+    size_t nodes = btree_count_nodes(root);
+
+    start = bench_now();
+    for (size_t i = 0; i < events && root != NULL; i++) {
+        root = btree_delete_multi(root, stream[i]);
+    }
+    double delete_time = bench_now() - start;
+
+    printf("multiset: %zu events, %d distinct -> %zu nodes (%zu bytes), counted %llu\n", events, distinct, nodes,
+           nodes * sizeof(btree_t), total);
+    printf("  insert: %.2f Mops/s\n", events / insert_time / 1e6);
+    printf("  delete: %.2f Mops/s, tree empty: %s\n", events / delete_time / 1e6, root == NULL ? "yes" : "no");
+
+    btree_free(root);
+    free(stream);
+}
+
+/**
+ * Benchmark inserting values in order, the worst case for a plain binary tree,
+ * on a plain tree and on a scapegoat tree.
+ *
+ * @param size the amount of values to insert.
+ */
+void btree_bench_sorted_ingest(int size) {
+    double start  = bench_now();
+    btree_t* root = btree_new_node(0);
+    for (int i = 1; i < size; i++) {
+        btree_insert(root, i);
+    }
+    double plain_insert = bench_now() - start;
+
+    size_t missing = 0;
+    start          = bench_now();
+    for (int i = 0; i < size; i++) {
+        missing += btree_search(root, i) == NULL;
+    }
+    double plain_search = bench_now() - start;
+
+    unsigned int plain_height = btree_get_height(root);
+    btree_free(root);
+
+    start                   = bench_now();
+    btree_scapegoat_t* tree = btree_scapegoat_new();
+    for (int i = 0; i < size; i++) {
+        btree_scapegoat_insert(tree, i);
+    }
+    double scapegoat_insert = bench_now() - start;
+
+    start = bench_now();
+    for (int i = 0; i < size; i++) {
+        missing += btree_scapegoat_search(tree, i) == NULL;
+    }
+    double scapegoat_search = bench_now() - start;
+
+    unsigned int scapegoat_height = btree_get_height(tree->root);
+
+    start = bench_now();
+    for (int i = 0; i < size; i += 2) {
+        btree_scapegoat_delete(tree, i);
+    }
+    double scapegoat_delete = bench_now() - start;
+
+    printf("sorted ingest of %d values:\n", size);
+    printf("  plain:     height %u, insert %.2f Mops/s, search %.2f Mops/s\n", plain_height,
+           size / plain_insert / 1e6, size / plain_search / 1e6);
+    printf("  scapegoat: height %u, insert %.2f Mops/s, search %.2f Mops/s, delete %.2f Mops/s, missing %zu\n",
+           scapegoat_height, size / scapegoat_insert / 1e6, size / scapegoat_search / 1e6,
+           (size / 2) / scapegoat_delete / 1e6, missing);
+    printf("  scapegoat after deleting half: %zu nodes, height %u\n", tree->size, btree_get_height(tree->root));
+
+    btree_scapegoat_free(tree);
+}
+
+/**
+ * Benchmark searching for values one at a time against btree_search_batch
+ * on a tree built from random values.
+ *
+ * @param size the amount of values inserted in the tree.
+ * @param lookups the amount of values to look for, half of them are in the tree.
+ */
+void btree_bench_search_batch(size_t size, size_t lookups) {
+    int* keys         = malloc(size * sizeof(int));
+    int* values       = malloc(lookups * sizeof(int));
+    btree_t** results = malloc(lookups * sizeof(btree_t*));
+    if (size == 0 || keys == NULL || values == NULL || results == NULL) {
+        printf("Failed to allocate benchmark data\n");
+        free(keys);
+        free(values);
+        free(results);
+        return;
+    }
+
+    srand(42);
+    for (size_t i = 0; i < size; i++) {
+        keys[i] = rand();
+    }
+    for (size_t i = 0; i < lookups; i++) {
+        values[i] = keys[rand() % size] + (i & 1);
+    }
+
+    btree_t* root = btree_new_node(keys[0]);
+    for (size_t i = 1; i < size; i++) {
+        btree_insert(root, keys[i]);
+    }
+
+    size_t found = 0;
+    double start = bench_now();
+    for (size_t i = 0; i < lookups; i++) {
+        found += btree_search(root, values[i]) != NULL;
+    }
+    double single_time = bench_now() - start;
+
+    start = bench_now();
+    btree_search_batch(root, values, lookups, results);
+    double batch_time = bench_now() - start;
+
+    size_t mismatches = 0;
+    for (size_t i = 0; i < lookups; i++) {
+        mismatches += results[i] != btree_search(root, values[i]);
+    }
+
+    printf("search batch: %zu nodes (%zu MB), %zu lookups, %zu found\n", size, size * sizeof(btree_t) >> 20, lookups,
+           found);
+    printf("  one at a time: %.2f Mops/s\n", lookups / single_time / 1e6);
+    printf("  batched:       %.2f Mops/s, mismatches: %zu\n", lookups / batch_time / 1e6, mismatches);
+
+    btree_free(root);
+    free(keys);
+    free(values);
+    free(results);
+}
+
+/**
+ * Count the nodes of a tree whose value is missing from another tree.
+ *
+ * @param tree a pointer to the root of the tree to check.
+ * @param other a pointer to the root of the tree to look in.
+ * @return the amount of values missing from other.
+ */
+size_t btree_bench_missing(const btree_t* tree, btree_t* other) {
+    if (tree == NULL) {
+        return 0;
+    }
+
+    return (btree_search(other, tree->content) == NULL) + btree_bench_missing(tree->left, other) +
+           btree_bench_missing(tree->right, other);
+}
+
+/**
+ * Benchmark the overhead of journaling inserts and deletes at several commit
+ * intervals, then replaying the journal before and after compacting it.
+ *
+ * @param operations the amount of inserts and deletes, a third of them are deletes.
+ */
+void btree_bench_journal(size_t operations) {
+    const char* path                = "/tmp/btree-bench";
+    unsigned int commit_intervals[] = {1, 16, 256, 4096, 0};
+
+    printf("journal: %zu operations\n", operations);
+    for (size_t c = 0; c < sizeof(commit_intervals) / sizeof(commit_intervals[0]); c++) {
+        btree_journal_remove(path);
+        btree_journal_t* journal = btree_journal_open(path, commit_intervals[c]);
+        if (journal == NULL) {
+            return;
+        }
+
+        srand(42);
+        double start  = bench_now();
+        btree_t* root = NULL;
+        for (size_t i = 0; i < operations; i++) {
+            root = btree_journal_insert(journal, root, rand() % operations);
+            if (i % 3 == 2) {
+                root = btree_journal_delete(journal, root, rand() % operations);
+            }
+        }
+        btree_journal_commit(journal);
+        double journal_time = bench_now() - start;
+
+        char label[16];
+        snprintf(label, sizeof(label), commit_intervals[c] != 0 ? "%u" : "close", commit_intervals[c]);
+
+        btree_t* replayed = NULL;
+        start             = bench_now();
+        btree_journal_replay(path, &replayed);
+        double replay_time = bench_now() - start;
+        size_t mismatches  = btree_bench_missing(root, replayed) + btree_bench_missing(replayed, root);
+        btree_free(replayed);
+
+        start = bench_now();
+        btree_journal_compact(journal, root);
+        double compact_time = bench_now() - start;
+        btree_journal_close(journal);
+
+        replayed = NULL;
+        start    = bench_now();
+        btree_journal_replay(path, &replayed);
+        double snapshot_replay_time = bench_now() - start;
+
+        mismatches += btree_bench_missing(root, replayed) + btree_bench_missing(replayed, root);
+        btree_free(replayed);
+        btree_free(root);
+
+        printf("  commit every %-5s:   %8.3f Mops/s, replay %.2f ms, compact %.2f ms, replay snapshot %.2f ms, "
+               "mismatches: %zu\n",
+               label, operations / journal_time / 1e6, replay_time * 1e3, compact_time * 1e3,
+               snapshot_replay_time * 1e3, mismatches);
+    }
+
+    btree_journal_remove(path);
+
+    srand(42);
+    double start  = bench_now();
+    btree_t* root = NULL;
+    for (size_t i = 0; i < operations; i++) {
+        root = btree_journal_insert(NULL, root, rand() % operations);
+        if (i % 3 == 2) {
+            root = btree_journal_delete(NULL, root, rand() % operations);
+        }
+    }
+    double base_time = bench_now() - start;
+    btree_free(root);
+    printf("  no journal:           %8.3f Mops/s\n", operations / base_time / 1e6);
+}
+
+/**
+ * Run all benchmarks for the binary tree.
+ *
+ * @return 0 on success.
+ */
+int btree_run_benchmarks() {
+    printf("============================= Benchmarks =======================================\n");
+    btree_bench_multiset(1000000, 64);
+    btree_bench_multiset(1000000, 1024);
+    btree_bench_search_batch(1 << 22, 1 << 22);
+    btree_bench_sorted_ingest(20000);
+    btree_bench_journal(1 << 16);
+    printf("================================================================================\n");
+    return 0;
+}
+
+int main(int argc, char* argv[]) {
+    if (argc > 1 && strcmp(argv[1], "bench") == 0) {
+        return btree_run_benchmarks();
+    }
+
+    printf("============================= Starting up ======================================\n");
+
+    btree_t* root = btree_new_node(8);
+    btree_insert(root, 3);
+    btree_insert(root, 10);
+    btree_insert(root, 1);
+    btree_insert(root, 6);
+    btree_insert(root, 4);
+    btree_insert(root, 7);
+    btree_insert(root, 14);
+    btree_insert(root, 13);
+    btree_insert(root, 20);
+
+    printf("Base tree:\n");
+    btree_print(root);
+    printf("================================================================================\n");
+
+    printf("Insert nodes with values 24 and 5:\n");
+    btree_insert(root, 24);
+    btree_insert(root, 5);
+
+    btree_print(root);
+    printf("================================================================================\n");
+
+    printf("Delete nodes with values 6 and 10:\n");
+    root = btree_delete(root, 6);
+    root = btree_delete(root, 10);
+
+    btree_print(root);
+    printf("================================================================================\n");
+
+    printf("Remove the root of the tree for testing:\n");
+    root = btree_delete(root, 8);
+
+    btree_print(root);
+    printf("================================================================================\n");
+
+    printf("Search for an existing element:\n");
+    btree_print(btree_search(root, 5));
+    printf("================================================================================\n");
+
+    printf("Search for an element that has been deleted:\n");
+    btree_print(btree_search(root, 10));
+    printf("================================================================================\n");
+
+    printf("Search for 5, 10, 24 in a single batch:\n");
+    int batch_values[] = {5, 10, 24};
+    btree_t* batch_results[3];
+    btree_search_batch(root, batch_values, 3, batch_results);
+    for (int i = 0; i < 3; i++) {
+        printf("%d: %s\n", batch_values[i], batch_results[i] != NULL ? "found" : "not found");
+    }
+    printf("================================================================================\n");
+
+    printf("Insert 5 twice and 20 three times as a multiset:\n");
+    btree_insert_multi(root, 5);
+    btree_insert_multi(root, 5);
+    btree_insert_multi(root, 20);
+    btree_insert_multi(root, 20);
+    btree_insert_multi(root, 20);
+    btree_print(root);
+    printf("Count for 5: %u - Count for 20: %u - Count for 99: %u\n", btree_count(root, 5), btree_count(root, 20),
+           btree_count(root, 99));
+    printf("================================================================================\n");
+
+    printf("Remove one occurrence of 20 and all occurrences of 5:\n");
+    root = btree_delete_multi(root, 20);
+    root = btree_delete_multi(root, 5);
+    root = btree_delete_multi(root, 5);
+    root = btree_delete_multi(root, 5);
+    btree_print(root);
+    printf("================================================================================\n");
+
+    btree_free(root);
+
+    printf("Journal inserts of 1 to 6 and the delete of 4, then replay them:\n");
+    const char* journal_path = "/tmp/btree-demo";
+    btree_journal_remove(journal_path);
+    btree_journal_t* journal = btree_journal_open(journal_path, 4);
+    btree_t* journaled       = NULL;
+    for (int i = 1; i <= 6; i++) {
+        journaled = btree_journal_insert(journal, journaled, i);
+    }
+    journaled = btree_journal_delete(journal, journaled, 4);
+    btree_journal_close(journal);
+    btree_free(journaled);
+
+    btree_journal_replay(journal_path, &journaled);
+    btree_print(journaled);
+    printf("================================================================================\n");
+
+    printf("Compact the journal, insert 9 and replay again:\n");
+    journal = btree_journal_open(journal_path, 4);
+    btree_journal_compact(journal, journaled);
+    journaled = btree_journal_insert(journal, journaled, 9);
+    btree_journal_close(journal);
+    btree_free(journaled);
+
+    btree_journal_replay(journal_path, &journaled);
+    btree_print(journaled);
+    printf("================================================================================\n");
+
+    printf("Tear the last record of the journal, reopen it, insert 10 to 12 and replay again:\n");
+    // The first bytes of a record, as left behind by a crash in the middle of a write.
+    const char torn_record[] = {BTREE_JOURNAL_INSERT, 7, 0};
+    char* torn_path          = btree_journal_path(journal_path, ".journal");
+    FILE* torn_file          = torn_path != NULL ? fopen(torn_path, "ab") : NULL;
+    if (torn_file != NULL) {
+        fwrite(torn_record, 1, sizeof(torn_record), torn_file);
+        fclose(torn_file);
+    }
+    free(torn_path);
+
+    journal = btree_journal_open(journal_path, 4);
+    for (int i = 10; i <= 12; i++) {
+        journaled = btree_journal_insert(journal, journaled, i);
+    }
+    btree_journal_close(journal);
+    btree_free(journaled);
+
+    btree_journal_replay(journal_path, &journaled);
+    btree_print(journaled);
+    btree_free(journaled);
+    btree_journal_remove(journal_path);
+    printf("================================================================================\n");
+
+    printf("Insert values 1 to 15 in order into a scapegoat tree:\n");
+    btree_scapegoat_t* scapegoat = btree_scapegoat_new();
+    for (int i = 1; i <= 15; i++) {
+        btree_scapegoat_insert(scapegoat, i);
+    }
+
+    btree_print(scapegoat->root);
+    printf("================================================================================\n");
+
+    printf("Delete nodes with values 1 to 6 from the scapegoat tree:\n");
+    for (int i = 1; i <= 6; i++) {
+        btree_scapegoat_delete(scapegoat, i);
+    }
+
+    btree_print(scapegoat->root);
+    printf("================================================================================\n");
+
+    btree_scapegoat_free(scapegoat);
 
     return 0;
 }
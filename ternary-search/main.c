@@ -1,5 +1,12 @@
+#include <pthread.h>
 #include <stddef.h>
+#include <stdint.h>
 #include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <time.h>
+#include <unistd.h>
 
 /**
  * This is a private method, you should call 'ternary_search' instead.
@@ -58,23 +65,1259 @@ int ternary_search(int needle, int haystack[], size_t haystack_size) {
     return _ternary_search(needle, haystack, 0, haystack_size - 1);
 }
 
+/**
+ * Look for needle in a haystack by halving the search space on every probe.
+ *
+ * Parameters:
+ *   needle: The value we will be looking for.
+ *   haystack: The array we will try to find the needle in.
+ *   haystack_size: The amount of elements in the haystack.
+ *
+ * Returns:
+ *   Index for the needle in the haystack if found, -1 otherwise.
+ */
+int binary_search(int needle, int haystack[], size_t haystack_size) {
+    if (haystack == NULL || haystack_size == 0) {
+        return -1;
+    }
+
+    size_t lower_bound = 0;
+    size_t upper_bound = haystack_size;
+    while (lower_bound < upper_bound) {
+        size_t pivot = lower_bound + (upper_bound - lower_bound) / 2;
+        if (haystack[pivot] == needle) {
+            return pivot;
+        } else if (haystack[pivot] < needle) {
+            lower_bound = pivot + 1;
+        } else {
+            upper_bound = pivot;
+        }
+    }
+
+    return -1;
+}
+
+/**
+ * This is a private method, it estimates where the needle should be by
+ * assuming the values between the bounds are evenly distributed.
+ *
+ * The caller must ensure haystack[lower_bound] <= needle <= haystack[upper_bound]
+ * and haystack[lower_bound] < haystack[upper_bound].
+ *
+ * Returns:
+ *   An index between lower_bound and upper_bound.
+ */
+size_t _interpolate(int needle, int haystack[], size_t lower_bound, size_t upper_bound) {
+    double offset = ((double)needle - haystack[lower_bound]) / ((double)haystack[upper_bound] - haystack[lower_bound]);
+    return lower_bound + (size_t)(offset * (upper_bound - lower_bound));
+}
+
+/**
+ * Look for needle in a haystack by probing where the needle would be if the
+ * values in the haystack were evenly distributed. On uniform data this takes
+ * around log(log(n)) probes, but it degrades to linear time on skewed data.
+ *
+ * Parameters:
+ *   needle: The value we will be looking for.
+ *   haystack: The array we will try to find the needle in.
+ *   haystack_size: The amount of elements in the haystack.
+ *
+ * Returns:
+ *   Index for the needle in the haystack if found, -1 otherwise.
+ */
+int interpolation_search(int needle, int haystack[], size_t haystack_size) {
+    if (haystack == NULL || haystack_size == 0) {
+        return -1;
+    }
+
+    size_t lower_bound = 0;
+    size_t upper_bound = haystack_size - 1;
+    while (lower_bound <= upper_bound && needle >= haystack[lower_bound] && needle <= haystack[upper_bound]) {
+        if (haystack[lower_bound] == haystack[upper_bound]) {
+            return lower_bound;
+        }
+
+        size_t pivot = _interpolate(needle, haystack, lower_bound, upper_bound);
+        if (haystack[pivot] == needle) {
+            return pivot;
+        } else if (haystack[pivot] < needle) {
+            lower_bound = pivot + 1;
+        } else {
+            upper_bound = pivot - 1;
+        }
+    }
+
+    return -1;
+}
+
+/**
+ * Look for needle in a haystack with a single interpolation probe, followed by
+ * a sequential scan from the probed index. Useful for small, uniform haystacks
+ * where the probe lands a few elements away from the needle.
+ *
+ * Parameters:
+ *   needle: The value we will be looking for.
+ *   haystack: The array we will try to find the needle in.
+ *   haystack_size: The amount of elements in the haystack.
+ *
+ * Returns:
+ *   Index for the needle in the haystack if found, -1 otherwise.
+ */
+int interpolation_sequential_search(int needle, int haystack[], size_t haystack_size) {
+    if (haystack == NULL || haystack_size == 0) {
+        return -1;
+    }
+
+    size_t upper_bound = haystack_size - 1;
+    if (needle < haystack[0] || needle > haystack[upper_bound]) {
+        return -1;
+    }
+
+    size_t pivot = haystack[0] == haystack[upper_bound] ? 0 : _interpolate(needle, haystack, 0, upper_bound);
+    while (haystack[pivot] < needle) {
+        pivot++;
+    }
+    while (haystack[pivot] > needle) {
+        pivot--;
+    }
+
+    return haystack[pivot] == needle ? (int)pivot : -1;
+}
+
+/**
+ * Look for needle in a haystack starting from a hint of where it might be. The
+ * search gallops away from the hint doubling its step until the needle is
+ * bracketed and then binary searches the bracket, taking log(d) probes where d
+ * is the distance between the hint and the needle.
+ *
+ * Parameters:
+ *   needle: The value we will be looking for.
+ *   haystack: The array we will try to find the needle in.
+ *   haystack_size: The amount of elements in the haystack.
+ *   hint: An index in the haystack close to where the needle is expected.
+ *
+ * Returns:
+ *   Index for the needle in the haystack if found, -1 otherwise.
+ */
+int exponential_search(int needle, int haystack[], size_t haystack_size, size_t hint) {
+    if (haystack == NULL || haystack_size == 0) {
+        return -1;
+    }
+
+    if (hint >= haystack_size) {
+        hint = haystack_size - 1;
+    }
+
+    if (haystack[hint] == needle) {
+        return hint;
+    }
+
+    size_t lower_bound;
+    size_t upper_bound;
+    size_t step = 1;
+    if (haystack[hint] < needle) {
+        lower_bound = hint + 1;
+        while (hint + step < haystack_size && haystack[hint + step] < needle) {
+            lower_bound = hint + step + 1;
+            step *= 2;
+        }
+        upper_bound = hint + step < haystack_size ? hint + step + 1 : haystack_size;
+    } else {
+        upper_bound = hint;
+        while (step <= hint && haystack[hint - step] > needle) {
+            upper_bound = hint - step;
+            step *= 2;
+        }
+        lower_bound = step <= hint ? hint - step : 0;
+    }
+
+    int index = binary_search(needle, haystack + lower_bound, upper_bound - lower_bound);
+    return index != -1 ? (int)lower_bound + index : -1;
+}
+
+typedef enum {
+    TERNARY,
+    BINARY,
+    INTERPOLATION,
+    INTERPOLATION_SEQUENTIAL,
+    EXPONENTIAL,
+    AUTO,
+} search_strategy_t;
+
+const char* search_strategy_names[] = {
+    "ternary", "binary", "interpolation", "interpolation-sequential", "exponential", "auto",
+};
+
+/**
+ * Sample a haystack to choose the search strategy expected to be the fastest
+ * for it.
+ *
+ * A few evenly spaced keys are compared against the values a perfectly uniform
+ * haystack would hold at the same indexes. If the keys stay close to those, the
+ * haystack is considered uniform and interpolation is used, otherwise we fall
+ * back to binary search, which does not depend on the distribution of values
+ * and takes fewer probes than ternary search.
+ *
+ * Since sampling is not free, it is done once per haystack by 'search_plan',
+ * or callers can call this once and pass the result to 'search'.
+ *
+ * Parameters:
+ *   haystack: The array that will be searched.
+ *   haystack_size: The amount of elements in the haystack.
+ *
+ * Returns:
+ *   The strategy to be used for the haystack, never AUTO.
+ */
+search_strategy_t search_pick_strategy(int haystack[], size_t haystack_size) {
+    const size_t samples = 16;
+
+    if (haystack == NULL || haystack_size < 64 || haystack[0] == haystack[haystack_size - 1]) {
+        return BINARY;
+    }
+
+    double first = haystack[0];
+    double range = (double)haystack[haystack_size - 1] - first;
+    double worst = 0;
+    for (size_t i = 1; i < samples; i++) {
+        size_t index    = i * (haystack_size - 1) / samples;
+        double expected = (double)index / (haystack_size - 1);
+        double error    = (haystack[index] - first) / range - expected;
+        if (error < 0) {
+            error = -error;
+        }
+        if (error > worst) {
+            worst = error;
+        }
+    }
+
+    if (worst > 1.0 / samples) {
+        return BINARY;
+    }
+    return haystack_size <= 4096 ? INTERPOLATION_SEQUENTIAL : INTERPOLATION;
+}
+
+/**
+ * Look for needle in a haystack using the provided strategy.
+ *
+ * Parameters:
+ *   needle: The value we will be looking for.
+ *   haystack: The array we will try to find the needle in.
+ *   haystack_size: The amount of elements in the haystack.
+ *   strategy: The search algorithm to be used, AUTO is only accepted by 'search_plan'.
+ *
+ * Returns:
+ *   Index for the needle in the haystack if found, -1 otherwise.
+ */
+int search(int needle, int haystack[], size_t haystack_size, search_strategy_t strategy) {
+    switch (strategy) {
+    case TERNARY:
+        return ternary_search(needle, haystack, haystack_size);
+    case BINARY:
+        return binary_search(needle, haystack, haystack_size);
+    case INTERPOLATION:
+        return interpolation_search(needle, haystack, haystack_size);
+    case INTERPOLATION_SEQUENTIAL:
+        return interpolation_sequential_search(needle, haystack, haystack_size);
+    case EXPONENTIAL:
+        return exponential_search(needle, haystack, haystack_size, 0);
+    default:
+        printf("Programmer logic error, invalid search strategy\n");
+        exit(-1);
+    }
+}
+
+typedef struct {
+    int* haystack;
+    size_t haystack_size;
+    search_strategy_t strategy;
+} search_plan_t;
+
+/**
+ * Prepare the lookups on a haystack, resolving AUTO to a concrete strategy by
+ * sampling the haystack once, so the lookups themselves do not pay for it.
+ *
+ * The haystack is not copied, it needs to outlive the plan.
+ *
+ * Parameters:
+ *   haystack: The array that will be searched.
+ *   haystack_size: The amount of elements in the haystack.
+ *   strategy: The search algorithm to be used, AUTO to pick one for the haystack.
+ *
+ * Returns:
+ *   The plan for searching the haystack, its strategy is never AUTO.
+ */
+search_plan_t search_plan(int haystack[], size_t haystack_size, search_strategy_t strategy) {
+    search_plan_t plan = {haystack, haystack_size, strategy};
+    if (strategy == AUTO) {
+        plan.strategy = search_pick_strategy(haystack, haystack_size);
+    }
+    return plan;
+}
+
+/**
+ * Look for needle in the haystack of a plan, using the strategy of the plan.
+ *
+ * Parameters:
+ *   needle: The value we will be looking for.
+ *   plan: The plan created for the haystack.
+ *
+ * Returns:
+ *   Index for the needle in the haystack if found, -1 otherwise.
+ */
+int search_planned(int needle, const search_plan_t* plan) {
+    return search(needle, plan->haystack, plan->haystack_size, plan->strategy);
+}
+
+/**
+ * Find the first position in a haystack holding a value that is not less than
+ * the needle, i.e. where the needle would be inserted to keep the haystack
+ * sorted.
+ *
+ * The search is iterative and the only branch in its loop is the loop
+ * condition itself, the comparison result is used to select the next base so
+ * the compiler can turn it into a conditional move. Since the CPU can no longer
+ * speculate on the next probe, both of its candidates are prefetched instead,
+ * which is what keeps it ahead of branchy searches on large haystacks.
+ *
+ * All indexes are size_t, so it can be used with haystacks of any size, like
+ * memory mapped files.
+ *
+ * Parameters:
+ *   needle: The value we will be looking for.
+ *   haystack: The array we will look into.
+ *   haystack_size: The amount of elements in the haystack.
+ *
+ * Returns:
+ *   Index of the first element not less than needle, haystack_size if there is none.
+ */
+size_t search_lower_bound(int needle, const int haystack[], size_t haystack_size) {
+    if (haystack == NULL || haystack_size == 0) {
+        return haystack_size;
+    }
+
+    const int* base = haystack;
+    size_t n        = haystack_size;
+    while (n > 1) {
+        size_t half = n / 2;
+        __builtin_prefetch(base + half / 2);
+        __builtin_prefetch(base + half + half / 2);
+        base  = base[half] < needle ? base + half : base;
+        n    -= half;
+    }
+
+    return (base - haystack) + (*base < needle);
+}
+
+/**
+ * Find the first position in a haystack holding a value that is greater than
+ * the needle. See 'search_lower_bound' for details on how the search is done.
+ *
+ * Parameters:
+ *   needle: The value we will be looking for.
+ *   haystack: The array we will look into.
+ *   haystack_size: The amount of elements in the haystack.
+ *
+ * Returns:
+ *   Index of the first element greater than needle, haystack_size if there is none.
+ */
+size_t search_upper_bound(int needle, const int haystack[], size_t haystack_size) {
+    if (haystack == NULL || haystack_size == 0) {
+        return haystack_size;
+    }
+
+    const int* base = haystack;
+    size_t n        = haystack_size;
+    while (n > 1) {
+        size_t half = n / 2;
+        __builtin_prefetch(base + half / 2);
+        __builtin_prefetch(base + half + half / 2);
+        base  = base[half] <= needle ? base + half : base;
+        n    -= half;
+    }
+
+    return (base - haystack) + (*base <= needle);
+}
+
+typedef struct {
+    size_t first;
+    size_t last;
+} search_range_t;
+
+/**
+ * Find the range of positions in a haystack holding values equal to the needle.
+ *
+ * Parameters:
+ *   needle: The value we will be looking for.
+ *   haystack: The array we will look into.
+ *   haystack_size: The amount of elements in the haystack.
+ *
+ * Returns:
+ *   A range where first is the lower bound and last the upper bound for the
+ *   needle. The range is empty, first == last, if the needle is not found.
+ */
+search_range_t search_equal_range(int needle, const int haystack[], size_t haystack_size) {
+    search_range_t range;
+    range.first = search_lower_bound(needle, haystack, haystack_size);
+    range.last  = range.first;
+    if (haystack != NULL && range.first < haystack_size && haystack[range.first] == needle) {
+        // Only the elements past the lower bound need to be looked at.
+        range.last += search_upper_bound(needle, haystack + range.first, haystack_size - range.first);
+    }
+    return range;
+}
+
+/**
+ * Max amount of samples kept by a search_index_t when no block size is
+ * requested, small enough for the samples to stay in the L2 cache.
+ */
+#define SEARCH_INDEX_MAX_SAMPLES (1 << 16)
+
+typedef struct {
+    const int* haystack;
+    size_t haystack_size;
+    size_t block_size;
+    int* samples;
+    size_t samples_size;
+} search_index_t;
+
+/**
+ * Create a two level index over a sorted haystack, sampling the first key of
+ * every block of block_size elements.
+ *
+ * Lookups first search the samples, which are small enough to stay in cache,
+ * to narrow the needle down to a single block, and only then touch the
+ * haystack. This avoids the first probes of a search over the whole haystack,
+ * which land on distant cache lines and pages that are almost always cold.
+ *
+ * The haystack is not copied, it needs to outlive the index.
+ *
+ * Parameters:
+ *   haystack: The sorted array to be indexed.
+ *   haystack_size: The amount of elements in the haystack.
+ *   block_size: The amount of elements covered by each sample, 0 to pick the
+ *               smallest one keeping at most SEARCH_INDEX_MAX_SAMPLES samples.
+ *
+ * Returns:
+ *   A pointer to the new index, NULL if we fail to allocate memory.
+ */
+search_index_t* search_index_new(const int haystack[], size_t haystack_size, size_t block_size) {
+    if (block_size == 0) {
+        block_size = (haystack_size + SEARCH_INDEX_MAX_SAMPLES - 1) / SEARCH_INDEX_MAX_SAMPLES;
+        if (block_size == 0) {
+            block_size = 1;
+        }
+    }
+
+    search_index_t* index = calloc(1, sizeof(search_index_t));
+    if (index == NULL) {
+        return NULL;
+    }
+
+    index->haystack      = haystack;
+    index->haystack_size = haystack != NULL ? haystack_size : 0;
+    index->block_size    = block_size;
+    index->samples_size  = (index->haystack_size + block_size - 1) / block_size;
+    if (index->samples_size == 0) {
+        return index;
+    }
+
+    index->samples = malloc(index->samples_size * sizeof(int));
+    if (index->samples == NULL) {
+        free(index);
+        return NULL;
+    }
+
+    for (size_t i = 0; i < index->samples_size; i++) {
+        index->samples[i] = haystack[i * block_size];
+    }
+
+    return index;
+}
+
+/**
+ * Free an index and its samples. The indexed haystack is left untouched.
+ *
+ * Parameters:
+ *   index: The index to be freed.
+ */
+void search_index_free(search_index_t* index) {
+    if (index == NULL) {
+        return;
+    }
+
+    free(index->samples);
+    free(index);
+}
+
+/**
+ * Find the first position in an indexed haystack holding a value that is not
+ * less than the needle.
+ *
+ * Parameters:
+ *   index: The index over the haystack.
+ *   needle: The value we will be looking for.
+ *
+ * Returns:
+ *   Index of the first element not less than needle, haystack_size if there is none.
+ */
+size_t search_index_lower_bound(const search_index_t* index, int needle) {
+    if (index == NULL || index->samples_size == 0) {
+        return 0;
+    }
+
+    // The first sample not less than the needle bounds the block the answer is in.
+    size_t sample = search_lower_bound(needle, index->samples, index->samples_size);
+    if (sample == 0) {
+        return 0;
+    }
+
+    size_t block_start = (sample - 1) * index->block_size;
+    size_t block_end   = sample * index->block_size;
+    if (block_end > index->haystack_size) {
+        block_end = index->haystack_size;
+    }
+
+    return block_start + search_lower_bound(needle, index->haystack + block_start, block_end - block_start);
+}
+
+/**
+ * Look for needle in an indexed haystack.
+ *
+ * Parameters:
+ *   index: The index over the haystack.
+ *   needle: The value we will be looking for.
+ *
+ * Returns:
+ *   Index for the needle in the haystack if found, -1 otherwise.
+ */
+ptrdiff_t search_index_find(const search_index_t* index, int needle) {
+    size_t position = search_index_lower_bound(index, needle);
+    if (index == NULL || position >= index->haystack_size || index->haystack[position] != needle) {
+        return -1;
+    }
+    return position;
+}
+
+/**
+ * Default amount of bits per element for a search_filter_t, giving a false
+ * positive rate close to 1%.
+ */
+#define SEARCH_FILTER_BITS_PER_VALUE 10
+
+/**
+ * Amount of 64 bit words per block of a search_filter_t, a block is a full
+ * cache line.
+ */
+#define SEARCH_FILTER_BLOCK_WORDS 8
+
+typedef struct {
+    uint64_t* blocks;
+    size_t blocks_size;
+} search_filter_t;
+
+/**
+ * Hash a value for a search_filter_t, the high half picks the block and the
+ * low half the bits within it.
+ */
+uint64_t _search_filter_hash(int value) {
+    uint64_t hash = (uint32_t)value;
+    hash          = (hash ^ (hash >> 30)) * 0xbf58476d1ce4e5b9ULL;
+    hash          = (hash ^ (hash >> 27)) * 0x94d049bb133111ebULL;
+    return hash ^ (hash >> 31);
+}
+
+/**
+ * Get the block of a search_filter_t a hash maps to, and the bit to be set in
+ * each of its words.
+ */
+uint64_t* _search_filter_block(const search_filter_t* filter, uint64_t hash, uint64_t bits[]) {
+    static const uint32_t salts[SEARCH_FILTER_BLOCK_WORDS] = {0x47b6137b, 0x44974d91, 0x8824ad5b, 0xa2b7289d,
+                                                              0x705495c7, 0x2df1424b, 0x9efc4947, 0x5c6bfb31};
+    for (int i = 0; i < SEARCH_FILTER_BLOCK_WORDS; i++) {
+        bits[i] = 1ULL << (((uint32_t)hash * salts[i]) >> 26);
+    }
+
+    size_t block = ((hash >> 32) * filter->blocks_size) >> 32;
+    return filter->blocks + block * SEARCH_FILTER_BLOCK_WORDS;
+}
+
+/**
+ * Add a value to a filter.
+ *
+ * Parameters:
+ *   filter: The filter to add the value to.
+ *   value: The value to be added.
+ */
+void search_filter_add(search_filter_t* filter, int value) {
+    uint64_t bits[SEARCH_FILTER_BLOCK_WORDS];
+    uint64_t* block = _search_filter_block(filter, _search_filter_hash(value), bits);
+    for (int i = 0; i < SEARCH_FILTER_BLOCK_WORDS; i++) {
+        block[i] |= bits[i];
+    }
+}
+
+/**
+ * Check whether a value may have been added to a filter. This touches a
+ * single cache line.
+ *
+ * Parameters:
+ *   filter: The filter to be checked.
+ *   needle: The value we will be looking for.
+ *
+ * Returns:
+ *   0 if the value is surely not in the filter, 1 if it may be.
+ */
+int search_filter_contains(const search_filter_t* filter, int needle) {
+    uint64_t bits[SEARCH_FILTER_BLOCK_WORDS];
+    const uint64_t* block = _search_filter_block(filter, _search_filter_hash(needle), bits);
+
+    uint64_t missing = 0;
+    for (int i = 0; i < SEARCH_FILTER_BLOCK_WORDS; i++) {
+        missing |= bits[i] & ~block[i];
+    }
+    return missing == 0;
+}
+
+/**
+ * Create a blocked Bloom filter holding every element of a haystack, letting
+ * searches for absent needles be rejected with a single cache line access
+ * instead of probing the haystack.
+ *
+ * Each value sets one bit in each word of a single block, so checking it
+ * never touches more than one cache line. The filter is built once, changing
+ * the haystack requires creating a new one.
+ *
+ * Parameters:
+ *   haystack: The array whose elements are added to the filter.
+ *   haystack_size: The amount of elements in the haystack.
+ *   bits_per_value: The size of the filter per element, 0 for SEARCH_FILTER_BITS_PER_VALUE.
+ *
+ * Returns:
+ *   A pointer to the new filter, NULL if we fail to allocate memory.
+ */
+search_filter_t* search_filter_new(const int haystack[], size_t haystack_size, size_t bits_per_value) {
+    if (haystack == NULL) {
+        haystack_size = 0;
+    }
+    if (bits_per_value == 0) {
+        bits_per_value = SEARCH_FILTER_BITS_PER_VALUE;
+    }
+
+    search_filter_t* filter = malloc(sizeof(search_filter_t));
+    if (filter == NULL) {
+        return NULL;
+    }
+
+    size_t block_bits   = SEARCH_FILTER_BLOCK_WORDS * 64;
+    filter->blocks_size = (haystack_size * bits_per_value + block_bits - 1) / block_bits;
+    if (filter->blocks_size == 0) {
+        filter->blocks_size = 1;
+    }
+
+    size_t block_bytes = SEARCH_FILTER_BLOCK_WORDS * sizeof(uint64_t);
+    filter->blocks     = aligned_alloc(block_bytes, filter->blocks_size * block_bytes);
+    if (filter->blocks == NULL) {
+        free(filter);
+        return NULL;
+    }
+
+    memset(filter->blocks, 0, filter->blocks_size * block_bytes);
+    for (size_t i = 0; i < haystack_size; i++) {
+        search_filter_add(filter, haystack[i]);
+    }
+    return filter;
+}
+
+/**
+ * Free a filter.
+ *
+ * Parameters:
+ *   filter: The filter to be freed.
+ */
+void search_filter_free(search_filter_t* filter) {
+    if (filter == NULL) {
+        return;
+    }
+
+    free(filter->blocks);
+    free(filter);
+}
+
+/**
+ * Look for needle in haystack with the provided strategy, skipping the search
+ * altogether when the filter rules the needle out.
+ *
+ * Parameters:
+ *   needle: The value we will be looking for.
+ *   haystack: The array we will look into.
+ *   haystack_size: The amount of elements in the haystack.
+ *   filter: A filter created from the haystack.
+ *   strategy: The algorithm to be used when the needle may be in the haystack, not AUTO.
+ *
+ * Returns:
+ *   Index for the needle in the haystack if found, -1 otherwise.
+ */
+int search_filtered(int needle, int haystack[], size_t haystack_size, const search_filter_t* filter,
+                    search_strategy_t strategy) {
+    if (filter != NULL && !search_filter_contains(filter, needle)) {
+        return -1;
+    }
+    return search(needle, haystack, haystack_size, strategy);
+}
+
+/**
+ * Find the first position in a haystack holding a value that is not less than
+ * the needle, knowing it is not before from.
+ *
+ * The search gallops away from from doubling its step until the position is
+ * bracketed and then searches the bracket with 'search_lower_bound', so it
+ * takes log(d) probes where d is the distance to the result. This makes it
+ * fast to walk a haystack with increasing needles.
+ *
+ * Parameters:
+ *   needle: The value we will be looking for.
+ *   haystack: The array we will look into.
+ *   haystack_size: The amount of elements in the haystack.
+ *   from: A position known to be before or at the result.
+ *
+ * Returns:
+ *   Index of the first element not less than needle, haystack_size if there is none.
+ */
+size_t search_gallop_lower_bound(int needle, const int haystack[], size_t haystack_size, size_t from) {
+    if (haystack == NULL || from >= haystack_size) {
+        return haystack_size;
+    }
+
+    if (haystack[from] >= needle) {
+        return from;
+    }
+
+    size_t lower = from;
+    size_t step  = 1;
+    while (lower + step < haystack_size && haystack[lower + step] < needle) {
+        lower += step;
+        step  *= 2;
+    }
+
+    size_t upper = lower + step < haystack_size ? lower + step : haystack_size;
+    return lower + 1 + search_lower_bound(needle, haystack + lower + 1, upper - lower - 1);
+}
+
+/**
+ * Look for every needle of a batch in a haystack, this is what each thread of
+ * a search_pool_t runs on its share of the batch.
+ *
+ * If the needles are sorted, the haystack is walked once in the same order,
+ * galloping from the position of the previous needle instead of searching the
+ * whole haystack for every needle.
+ *
+ * Parameters:
+ *   needles: The values we will be looking for.
+ *   needles_size: The amount of needles.
+ *   haystack: The sorted array we will look into.
+ *   haystack_size: The amount of elements in the haystack.
+ *   results: Where to store the index of the first occurrence of each needle, -1 if not found.
+ */
+void search_batch_serial(const int needles[], size_t needles_size, const int haystack[], size_t haystack_size,
+                         ptrdiff_t results[]) {
+    if (haystack == NULL) {
+        for (size_t i = 0; i < needles_size; i++) {
+            results[i] = -1;
+        }
+        return;
+    }
+
+    int sorted = 1;
+    for (size_t i = 1; i < needles_size && sorted; i++) {
+        sorted = needles[i - 1] <= needles[i];
+    }
+
+    size_t position = 0;
+    for (size_t i = 0; i < needles_size; i++) {
+        if (sorted) {
+            position = search_gallop_lower_bound(needles[i], haystack, haystack_size, position);
+        } else {
+            position = search_lower_bound(needles[i], haystack, haystack_size);
+        }
+
+        results[i] = position < haystack_size && haystack[position] == needles[i] ? (ptrdiff_t)position : -1;
+    }
+}
+
+/**
+ * Minimum amount of needles handed to a thread of a search_pool_t at once.
+ */
+#define SEARCH_POOL_MIN_CHUNK 1024
+
+typedef struct {
+    pthread_t* threads;
+    unsigned int threads_size;
+
+    pthread_mutex_t lock;
+    pthread_cond_t work_ready;
+    pthread_cond_t work_done;
+
+    // Held for the whole of a call to search_pool_batch, a pool runs a single batch at a time.
+    pthread_mutex_t batch_lock;
+
+    // The batch currently being processed, only valid while pending > 0.
+    const int* needles;
+    size_t needles_size;
+    const int* haystack;
+    size_t haystack_size;
+    ptrdiff_t* results;
+    size_t chunk_size;
+    size_t next_chunk;
+    size_t chunks;
+    size_t pending;
+
+    int stop;
+} search_pool_t;
+
+/**
+ * This is a private method, it is the main loop for the threads in a
+ * search_pool_t. Each thread takes chunks of the current batch until there
+ * are none left and then waits for the next one.
+ */
+void* _search_pool_worker(void* arg) {
+    search_pool_t* pool = arg;
+
+    pthread_mutex_lock(&pool->lock);
+    while (1) {
+        while (!pool->stop && pool->next_chunk >= pool->chunks) {
+            pthread_cond_wait(&pool->work_ready, &pool->lock);
+        }
+
+        if (pool->stop) {
+            break;
+        }
+
+        size_t start = pool->next_chunk++ * pool->chunk_size;
+        size_t end   = start + pool->chunk_size < pool->needles_size ? start + pool->chunk_size : pool->needles_size;
+        pthread_mutex_unlock(&pool->lock);
+
+        search_batch_serial(pool->needles + start, end - start, pool->haystack, pool->haystack_size,
+                            pool->results + start);
+
+        pthread_mutex_lock(&pool->lock);
+        if (--pool->pending == 0) {
+            pthread_cond_signal(&pool->work_done);
+        }
+    }
+    pthread_mutex_unlock(&pool->lock);
+
+    return NULL;
+}
+
+/**
+ * Free a search pool, stopping all of its threads.
+ *
+ * Parameters:
+ *   pool: The pool to be freed.
+ */
+void search_pool_free(search_pool_t* pool) {
+    if (pool == NULL) {
+        return;
+    }
+
+    pthread_mutex_lock(&pool->lock);
+    pool->stop = 1;
+    pthread_cond_broadcast(&pool->work_ready);
+    pthread_mutex_unlock(&pool->lock);
+
+    for (unsigned int i = 0; i < pool->threads_size; i++) {
+        pthread_join(pool->threads[i], NULL);
+    }
+
+    pthread_cond_destroy(&pool->work_done);
+    pthread_cond_destroy(&pool->work_ready);
+    pthread_mutex_destroy(&pool->lock);
+    pthread_mutex_destroy(&pool->batch_lock);
+    free(pool->threads);
+    free(pool);
+}
+
+/**
+ * Create a pool of threads for running batches of searches in parallel.
+ *
+ * Parameters:
+ *   threads_size: The amount of threads to start, 0 to start one per online CPU.
+ *
+ * Returns:
+ *   A pointer to the new pool, NULL if we fail to allocate memory or start the threads.
+ */
+search_pool_t* search_pool_new(unsigned int threads_size) {
+    if (threads_size == 0) {
+        long cpus    = sysconf(_SC_NPROCESSORS_ONLN);
+        threads_size = cpus > 0 ? cpus : 1;
+    }
+
+    search_pool_t* pool = calloc(1, sizeof(search_pool_t));
+    if (pool == NULL) {
+        return NULL;
+    }
+
+    pool->threads = calloc(threads_size, sizeof(pthread_t));
+    if (pool->threads == NULL) {
+        free(pool);
+        return NULL;
+    }
+
+    pthread_mutex_init(&pool->lock, NULL);
+    pthread_mutex_init(&pool->batch_lock, NULL);
+    pthread_cond_init(&pool->work_ready, NULL);
+    pthread_cond_init(&pool->work_done, NULL);
+
+    for (; pool->threads_size < threads_size; pool->threads_size++) {
+        if (pthread_create(&pool->threads[pool->threads_size], NULL, _search_pool_worker, pool) != 0) {
+            search_pool_free(pool);
+            return NULL;
+        }
+    }
+
+    return pool;
+}
+
+/**
+ * Look for every needle of a batch in a haystack, splitting the needles in
+ * chunks across the threads of a pool. Results are the same as running
+ * 'search_batch_serial' over the whole batch.
+ *
+ * Chunks are contiguous parts of the batch, so on sorted batches every thread
+ * walks its own part of the haystack in order.
+ *
+ * Calls on the same pool from several threads are safe, they are run one
+ * batch after the other.
+ *
+ * Parameters:
+ *   pool: The pool of threads to run the searches on.
+ *   needles: The values we will be looking for.
+ *   needles_size: The amount of needles.
+ *   haystack: The sorted array we will look into, it must not change during the call.
+ *   haystack_size: The amount of elements in the haystack.
+ *   results: Where to store the index of the first occurrence of each needle, -1 if not found.
+ */
+void search_pool_batch(search_pool_t* pool, const int needles[], size_t needles_size, const int haystack[],
+                       size_t haystack_size, ptrdiff_t results[]) {
+    if (pool == NULL || needles_size == 0 || haystack == NULL) {
+        search_batch_serial(needles, needles_size, haystack, haystack_size, results);
+        return;
+    }
+
+    size_t chunk_size = needles_size / (pool->threads_size * 4);
+    if (chunk_size < SEARCH_POOL_MIN_CHUNK) {
+        chunk_size = SEARCH_POOL_MIN_CHUNK;
+    }
+
+    pthread_mutex_lock(&pool->batch_lock);
+    pthread_mutex_lock(&pool->lock);
+    pool->needles       = needles;
+    pool->needles_size  = needles_size;
+    pool->haystack      = haystack;
+    pool->haystack_size = haystack_size;
+    pool->results       = results;
+    pool->chunk_size    = chunk_size;
+    pool->chunks        = (needles_size + chunk_size - 1) / chunk_size;
+    pool->pending       = pool->chunks;
+    pool->next_chunk    = 0;
+    pthread_cond_broadcast(&pool->work_ready);
+
+    while (pool->pending > 0) {
+        pthread_cond_wait(&pool->work_done, &pool->lock);
+    }
+    pthread_mutex_unlock(&pool->lock);
+    pthread_mutex_unlock(&pool->batch_lock);
+}
+
+typedef struct {
+    int needle;
+    int index;
+    int* haystack;
+    size_t haystack_size;
+} test_case;
+
+/**
+ * Run a test case for the provided search strategy.
+ *
+ * Returns 0 if the test succeeds, 1 otherwise
+ */
+int execute_test(test_case* t, search_strategy_t strategy) {
+    printf("[%s] Expect needle '%d' at '%d' - haystack '%p' - size '%zu': ", search_strategy_names[strategy], t->needle,
+           t->index, t->haystack, t->haystack_size);
+
+    search_plan_t plan = search_plan(t->haystack, t->haystack_size, strategy);
+    int index          = search_planned(t->needle, &plan);
+    if (t->index != index) {
+        printf("Error!!\n\tGot index '%d'\n", index);
+        return 1;
+    }
+
+    printf("OK\n");
+    return 0;
+}
+
+/**
+ * Run a test case through a search_index_t with the provided block size.
+ *
+ * Returns 0 if the test succeeds, 1 otherwise
+ */
+int execute_index_test(test_case* t, size_t block_size) {
+    printf("[index/%zu] Expect needle '%d' at '%d' - haystack '%p' - size '%zu': ", block_size, t->needle, t->index,
+           t->haystack, t->haystack_size);
+
+    search_index_t* index = search_index_new(t->haystack, t->haystack_size, block_size);
+    if (index == NULL) {
+        printf("Error!!\n\tFailed to create index\n");
+        return 1;
+    }
+
+    ptrdiff_t found = search_index_find(index, t->needle);
+    search_index_free(index);
+    if (t->index != found) {
+        printf("Error!!\n\tGot index '%td'\n", found);
+        return 1;
+    }
+
+    printf("OK\n");
+    return 0;
+}
+
+/**
+ * Run a test case through search_filtered, with a filter created from the haystack.
+ *
+ * Returns 0 if the test succeeds, 1 otherwise
+ */
+int execute_filter_test(test_case* t) {
+    printf("[filter] Expect needle '%d' at '%d' - haystack '%p' - size '%zu': ", t->needle, t->index, t->haystack,
+           t->haystack_size);
+
+    search_filter_t* filter = search_filter_new(t->haystack, t->haystack_size, 0);
+    if (filter == NULL) {
+        printf("Error!!\n\tFailed to create filter\n");
+        return 1;
+    }
+
+    int index = search_filtered(t->needle, t->haystack, t->haystack_size, filter, TERNARY);
+    search_filter_free(filter);
+    if (t->index != index) {
+        printf("Error!!\n\tGot index '%d'\n", index);
+        return 1;
+    }
+
+    printf("OK\n");
+    return 0;
+}
+
+/**
+ * Compare two integers, to be used with qsort.
+ */
+int compare_ints(const void* a, const void* b) {
+    int x = *(const int*)a;
+    int y = *(const int*)b;
+    return (x > y) - (x < y);
+}
+
+/**
+ * Compare two test cases by their needle, to be used with qsort.
+ */
+int compare_test_cases(const void* a, const void* b) {
+    return compare_ints(&((const test_case*)a)->needle, &((const test_case*)b)->needle);
+}
+
+/**
+ * Run the test cases searching the provided haystack as a single batch on a
+ * search_pool_t.
+ *
+ * Returns 0 if the test succeeds, 1 otherwise
+ */
+int execute_batch_test(test_case* test_cases, size_t test_cases_size, int* haystack, size_t haystack_size,
+                       int sorted) {
+    printf("[batch/%s] Expect needles in %zu test cases - haystack '%p' - size '%zu': ",
+           sorted ? "sorted" : "unsorted", test_cases_size, haystack, haystack_size);
+
+    test_case* cases    = malloc(test_cases_size * sizeof(test_case));
+    int* needles        = malloc(test_cases_size * sizeof(int));
+    ptrdiff_t* results  = malloc(test_cases_size * sizeof(ptrdiff_t));
+    search_pool_t* pool = search_pool_new(4);
+    if (cases == NULL || needles == NULL || results == NULL || pool == NULL) {
+        printf("Error!!\n\tFailed to allocate memory\n");
+        free(cases);
+        free(needles);
+        free(results);
+        search_pool_free(pool);
+        return 1;
+    }
+
+    size_t cases_size = 0;
+    for (size_t i = 0; i < test_cases_size; i++) {
+        if (test_cases[i].haystack == haystack && test_cases[i].haystack_size == haystack_size) {
+            cases[cases_size++] = test_cases[i];
+        }
+    }
+
+    if (sorted) {
+        qsort(cases, cases_size, sizeof(test_case), compare_test_cases);
+    }
+
+    for (size_t i = 0; i < cases_size; i++) {
+        needles[i] = cases[i].needle;
+    }
+
+    search_pool_batch(pool, needles, cases_size, haystack, haystack_size, results);
+
+    int failed = 0;
+    for (size_t i = 0; i < cases_size; i++) {
+        if (results[i] != cases[i].index) {
+            if (!failed) {
+                printf("Error!!\n");
+            }
+            printf("\tGot index '%td' for needle '%d'\n", results[i], cases[i].needle);
+            failed = 1;
+        }
+    }
+
+    free(cases);
+    free(needles);
+    free(results);
+    search_pool_free(pool);
+
+    if (!failed) {
+        printf("OK\n");
+    }
+    return failed;
+}
+
+typedef struct {
+    search_pool_t* pool;
+    const int* needles;
+    size_t needles_size;
+    const int* haystack;
+    size_t haystack_size;
+    ptrdiff_t* results;
+} batch_test_call;
+
+/**
+ * Run a batch from another thread, to be used with pthread_create.
+ */
+void* execute_batch_test_call(void* arg) {
+    batch_test_call* call = arg;
+    search_pool_batch(call->pool, call->needles, call->needles_size, call->haystack, call->haystack_size,
+                      call->results);
+    return NULL;
+}
+
+/**
+ * Run a batch big enough to be split in many chunks across the threads of a
+ * search_pool_t, twice at the same time from two threads. The haystack holds
+ * the even numbers, so odd needles are misses.
+ *
+ * Returns 0 if the test succeeds, 1 otherwise
+ */
+int execute_large_batch_test(int sorted) {
+    const size_t haystack_size = 1 << 14;
+    const size_t needles_size  = SEARCH_POOL_MIN_CHUNK * 32 + 7;
+
+    printf("[batch/%s] Expect %zu needles in chunks of at least %d - size '%zu': ", sorted ? "sorted" : "unsorted",
+           needles_size, SEARCH_POOL_MIN_CHUNK, haystack_size);
+
+    int* haystack       = malloc(haystack_size * sizeof(int));
+    int* needles        = malloc(needles_size * sizeof(int));
+    ptrdiff_t* results  = malloc(2 * needles_size * sizeof(ptrdiff_t));
+    search_pool_t* pool = search_pool_new(4);
+    if (haystack == NULL || needles == NULL || results == NULL || pool == NULL) {
+        printf("Error!!\n\tFailed to allocate memory\n");
+        free(haystack);
+        free(needles);
+        free(results);
+        search_pool_free(pool);
+        return 1;
+    }
+
+    for (size_t i = 0; i < haystack_size; i++) {
+        haystack[i] = 2 * i;
+    }
+    for (size_t i = 0; i < needles_size; i++) {
+        needles[i] = rand() % (2 * haystack_size + 2) - 1;
+    }
+    if (sorted) {
+        qsort(needles, needles_size, sizeof(int), compare_ints);
+    }
+
+    batch_test_call call = {pool, needles, needles_size, haystack, haystack_size, results + needles_size};
+    pthread_t thread;
+    int started = pthread_create(&thread, NULL, execute_batch_test_call, &call) == 0;
+    search_pool_batch(pool, needles, needles_size, haystack, haystack_size, results);
+    if (started) {
+        pthread_join(thread, NULL);
+    } else {
+        execute_batch_test_call(&call);
+    }
+
+    int failed = 0;
+    for (size_t i = 0; i < 2 * needles_size; i++) {
+        int needle         = needles[i % needles_size];
+        ptrdiff_t expected = needle >= 0 && needle % 2 == 0 && (size_t)needle / 2 < haystack_size ? needle / 2 : -1;
+        if (results[i] != expected) {
+            if (!failed) {
+                printf("Error!!\n");
+            }
+            printf("\tGot index '%td' for needle '%d' at '%zu'\n", results[i], needle, i % needles_size);
+            failed = 1;
+            break;
+        }
+    }
+
+    free(haystack);
+    free(needles);
+    free(results);
+    search_pool_free(pool);
+
+    if (!failed) {
+        printf("OK\n");
+    }
+    return failed;
+}
+
 typedef struct {
     int needle;
-    int index;
+    size_t lower;
+    size_t upper;
     int* haystack;
     size_t haystack_size;
-} test_case;
+} bounds_test_case;
 
 /**
- * Run a test case for ternary_search.
+ * Run a test case for search_lower_bound, search_upper_bound and search_equal_range.
  *
  * Returns 0 if the test succeeds, 1 otherwise
  */
-int execute_test(test_case* t) {
-    printf("Expect needle '%d' at '%d' - haystack '%p' - size '%zu': ", t->needle, t->index, t->haystack,
-           t->haystack_size);
+int execute_bounds_test(bounds_test_case* t) {
+    printf("[bounds] Expect needle '%d' in '[%zu, %zu)' - haystack '%p' - size '%zu': ", t->needle, t->lower, t->upper,
+           t->haystack, t->haystack_size);
+
+    size_t lower         = search_lower_bound(t->needle, t->haystack, t->haystack_size);
+    size_t upper         = search_upper_bound(t->needle, t->haystack, t->haystack_size);
+    search_range_t range = search_equal_range(t->needle, t->haystack, t->haystack_size);
+    if (t->lower != lower || t->upper != upper || range.first != lower ||
+        range.last != (lower != upper ? upper : lower)) {
+        printf("Error!!\n\tGot bounds '[%zu, %zu)' and range '[%zu, %zu)'\n", lower, upper, range.first, range.last);
+        return 1;
+    }
+
+    printf("OK\n");
+    return 0;
+}
+
+/**
+ * Run a test case through exponential_search starting from the provided hint.
+ *
+ * Returns 0 if the test succeeds, 1 otherwise
+ */
+int execute_hint_test(test_case* t, size_t hint) {
+    printf("[exponential/hint %zu] Expect needle '%d' at '%d' - haystack '%p' - size '%zu': ", hint, t->needle,
+           t->index, t->haystack, t->haystack_size);
 
-    int index = ternary_search(t->needle, t->haystack, t->haystack_size);
+    int index = exponential_search(t->needle, t->haystack, t->haystack_size, hint);
     if (t->index != index) {
         printf("Error!!\n\tGot index '%d'\n", index);
         return 1;
@@ -84,7 +1327,451 @@ int execute_test(test_case* t) {
     return 0;
 }
 
+typedef struct {
+    int* haystack;
+    size_t haystack_size;
+    search_strategy_t strategy;
+} strategy_test_case;
+
+/**
+ * Run a test case for search_pick_strategy and search_plan with AUTO.
+ *
+ * Returns 0 if the test succeeds, 1 otherwise
+ */
+int execute_strategy_test(strategy_test_case* t) {
+    printf("[pick] Expect '%s' - haystack '%p' - size '%zu': ", search_strategy_names[t->strategy], t->haystack,
+           t->haystack_size);
+
+    search_strategy_t picked = search_pick_strategy(t->haystack, t->haystack_size);
+    search_plan_t plan       = search_plan(t->haystack, t->haystack_size, AUTO);
+    if (t->strategy != picked || t->strategy != plan.strategy) {
+        printf("Error!!\n\tGot '%s' and a plan for '%s'\n", search_strategy_names[picked],
+               search_strategy_names[plan.strategy]);
+        return 1;
+    }
+
+    printf("OK\n");
+    return 0;
+}
+
+/**
+ * Get a monotonic timestamp, used for measuring elapsed time in benchmarks.
+ *
+ * Returns:
+ *   The current time in seconds.
+ */
+double bench_now() {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+/**
+ * Benchmark every search strategy against a haystack, checking they all agree
+ * with ternary_search on whether each needle is present.
+ *
+ * Strategies that degrade badly on a haystack stop after a second, their
+ * throughput is computed from the lookups done by then.
+ *
+ * Parameters:
+ *   name: A name for the haystack to be printed.
+ *   haystack: The array to search in.
+ *   haystack_size: The amount of elements in the haystack.
+ *   needles: The values to look for.
+ *   results: Scratch space for the indexes found, as big as needles.
+ *   needles_size: The amount of needles.
+ */
+void bench_strategies(const char* name, int haystack[], size_t haystack_size, int needles[], int results[],
+                      size_t needles_size) {
+    search_strategy_t picked = search_pick_strategy(haystack, haystack_size);
+    printf("%s haystack, %zu elements, %zu lookups (auto picks %s):\n", name, haystack_size, needles_size,
+           search_strategy_names[picked]);
+
+    for (search_strategy_t strategy = TERNARY; strategy <= AUTO; strategy++) {
+        // Planning is timed too, it is where AUTO samples the haystack.
+        size_t done        = 0;
+        double start       = bench_now();
+        search_plan_t plan = search_plan(haystack, haystack_size, strategy);
+        while (done < needles_size) {
+            size_t batch_end = done + 4096 < needles_size ? done + 4096 : needles_size;
+            for (; done < batch_end; done++) {
+                results[done] = search_planned(needles[done], &plan);
+            }
+            if (bench_now() - start > 1.0) {
+                break;
+            }
+        }
+        double elapsed = bench_now() - start;
+
+        size_t mismatches = 0;
+        for (size_t i = 0; i < done; i++) {
+            int expected = ternary_search(needles[i], haystack, haystack_size);
+            if ((results[i] == -1) != (expected == -1) || (results[i] != -1 && haystack[results[i]] != needles[i])) {
+                mismatches++;
+            }
+        }
+
+        printf("  %-26s %8.2f Mlookups/s - mismatches: %zu%s\n", search_strategy_names[strategy],
+               done / elapsed / 1e6, mismatches, done < needles_size ? " (timed out)" : "");
+    }
+}
+
+/**
+ * Benchmark search_lower_bound against ternary_search on exact match lookups.
+ *
+ * Parameters:
+ *   haystack: The array to search in.
+ *   haystack_size: The amount of elements in the haystack.
+ *   needles: The values to look for.
+ *   needles_size: The amount of needles.
+ */
+void bench_bounds(int haystack[], size_t haystack_size, int needles[], size_t needles_size) {
+    long found   = 0;
+    double start = bench_now();
+    for (size_t i = 0; i < needles_size; i++) {
+        found += ternary_search(needles[i], haystack, haystack_size) != -1;
+    }
+    double ternary_time = bench_now() - start;
+
+    long bound_found = 0;
+    start            = bench_now();
+    for (size_t i = 0; i < needles_size; i++) {
+        size_t index = search_lower_bound(needles[i], haystack, haystack_size);
+        bound_found += index < haystack_size && haystack[index] == needles[i];
+    }
+    double bound_time = bench_now() - start;
+
+    printf("Exact match on %zu elements: ternary %.2f Mlookups/s - lower bound %.2f Mlookups/s (found %ld/%ld)\n",
+           haystack_size, needles_size / ternary_time / 1e6, needles_size / bound_time / 1e6, bound_found, found);
+}
+
+/**
+ * Benchmark lookups through a search_index_t against ternary_search and
+ * search_lower_bound on a haystack much larger than the CPU caches.
+ *
+ * Returns:
+ *   0 on success, 1 if memory could not be allocated or the results differ.
+ */
+int bench_index() {
+    const size_t haystack_size = 1 << 27;
+    const size_t needles_size  = 1 << 22;
+
+    int* haystack = malloc(haystack_size * sizeof(int));
+    int* needles  = malloc(needles_size * sizeof(int));
+    if (haystack == NULL || needles == NULL) {
+        free(haystack);
+        free(needles);
+        return 1;
+    }
+
+    srand(42);
+    for (size_t i = 0; i < haystack_size; i++) {
+        haystack[i] = i * 8 + rand() % 8;
+    }
+    for (size_t i = 0; i < needles_size; i++) {
+        needles[i] = haystack[rand() % haystack_size] + (i & 1);
+    }
+
+    double start          = bench_now();
+    search_index_t* index = search_index_new(haystack, haystack_size, 0);
+    double build          = bench_now() - start;
+    if (index == NULL) {
+        free(haystack);
+        free(needles);
+        return 1;
+    }
+
+    long ternary_found = 0;
+    start              = bench_now();
+    for (size_t i = 0; i < needles_size; i++) {
+        ternary_found += ternary_search(needles[i], haystack, haystack_size) != -1;
+    }
+    double ternary_time = bench_now() - start;
+
+    long bound_found = 0;
+    start            = bench_now();
+    for (size_t i = 0; i < needles_size; i++) {
+        size_t position  = search_lower_bound(needles[i], haystack, haystack_size);
+        bound_found     += position < haystack_size && haystack[position] == needles[i];
+    }
+    double bound_time = bench_now() - start;
+
+    long index_found = 0;
+    start            = bench_now();
+    for (size_t i = 0; i < needles_size; i++) {
+        index_found += search_index_find(index, needles[i]) != -1;
+    }
+    double index_time = bench_now() - start;
+
+    printf("Index over %zu elements: %zu samples (%zu KB), blocks of %zu, built in %.2f ms\n", haystack_size,
+           index->samples_size, index->samples_size * sizeof(int) / 1024, index->block_size, build * 1e3);
+    printf("  ternary %.2f Mlookups/s - lower bound %.2f Mlookups/s - index %.2f Mlookups/s (found %ld/%ld/%ld)\n",
+           needles_size / ternary_time / 1e6, needles_size / bound_time / 1e6, needles_size / index_time / 1e6,
+           ternary_found, bound_found, index_found);
+
+    search_index_free(index);
+    free(haystack);
+    free(needles);
+    return ternary_found != index_found;
+}
+
+/**
+ * Benchmark ternary_search with and without a search_filter_t in front of it,
+ * for a growing share of needles missing from the haystack.
+ *
+ * Returns:
+ *   0 on success, 1 if memory could not be allocated or the results differ.
+ */
+int bench_filter() {
+    const size_t haystack_size  = 1 << 22;
+    const size_t needles_size   = 1 << 20;
+    const double miss_ratios[]  = {0, 0.5, 0.9, 0.99, 1};
+    const size_t bits_options[] = {8, 10, 16};
+
+    int* haystack = malloc(haystack_size * sizeof(int));
+    int* needles  = malloc(needles_size * sizeof(int));
+    if (haystack == NULL || needles == NULL) {
+        free(haystack);
+        free(needles);
+        return 1;
+    }
+
+    // Only even values are in the haystack, so odd needles are always misses.
+    srand(42);
+    for (size_t i = 0; i < haystack_size; i++) {
+        haystack[i] = (i * 8 + rand() % 8) * 2;
+    }
+
+    size_t errors = 0;
+    for (size_t b = 0; b < sizeof(bits_options) / sizeof(*bits_options); b++) {
+        double start            = bench_now();
+        search_filter_t* filter = search_filter_new(haystack, haystack_size, bits_options[b]);
+        double build            = bench_now() - start;
+        if (filter == NULL) {
+            errors++;
+            break;
+        }
+
+        printf("Filter over %zu elements, %zu bits per element (%zu KB), built in %.2f ms:\n", haystack_size,
+               bits_options[b], filter->blocks_size * SEARCH_FILTER_BLOCK_WORDS * sizeof(uint64_t) / 1024,
+               build * 1e3);
+
+        for (size_t m = 0; m < sizeof(miss_ratios) / sizeof(*miss_ratios); m++) {
+            size_t misses = 0;
+            for (size_t i = 0; i < needles_size; i++) {
+                int miss   = rand() < miss_ratios[m] * ((double)RAND_MAX + 1);
+                needles[i] = haystack[rand() % haystack_size] + miss;
+                misses    += miss;
+            }
+
+            long found = 0;
+            start      = bench_now();
+            for (size_t i = 0; i < needles_size; i++) {
+                found += ternary_search(needles[i], haystack, haystack_size) != -1;
+            }
+            double plain_time = bench_now() - start;
+
+            long filtered_found = 0;
+            start               = bench_now();
+            for (size_t i = 0; i < needles_size; i++) {
+                filtered_found += search_filtered(needles[i], haystack, haystack_size, filter, TERNARY) != -1;
+            }
+            double filtered_time = bench_now() - start;
+
+            size_t false_positives = 0;
+            for (size_t i = 0; i < needles_size; i++) {
+                false_positives += (needles[i] & 1) && search_filter_contains(filter, needles[i]);
+            }
+            errors += found != filtered_found;
+
+            printf("  %3.0f%% misses: ternary %6.2f Mlookups/s - filtered %6.2f Mlookups/s - false positives %.2f%% "
+                   "(found %ld/%ld)\n",
+                   miss_ratios[m] * 100, needles_size / plain_time / 1e6, needles_size / filtered_time / 1e6,
+                   misses ? 100.0 * false_positives / misses : 0.0, filtered_found, found);
+        }
+
+        search_filter_free(filter);
+    }
+
+    free(haystack);
+    free(needles);
+    return errors != 0;
+}
+
+/**
+ * Benchmark batches of searches on search_pool_t with a growing amount of
+ * threads, for both unsorted and sorted batches, against the serial path.
+ *
+ * Returns:
+ *   0 on success, 1 if memory could not be allocated or the results differ.
+ */
+int bench_batch() {
+    const size_t haystack_size = 1 << 24;
+    const size_t needles_size  = 1 << 23;
+
+    int* haystack      = malloc(haystack_size * sizeof(int));
+    int* needles       = malloc(needles_size * sizeof(int));
+    ptrdiff_t* serial  = malloc(needles_size * sizeof(ptrdiff_t));
+    ptrdiff_t* results = malloc(needles_size * sizeof(ptrdiff_t));
+    if (haystack == NULL || needles == NULL || serial == NULL || results == NULL) {
+        free(haystack);
+        free(needles);
+        free(serial);
+        free(results);
+        return 1;
+    }
+
+    srand(42);
+    for (size_t i = 0; i < haystack_size; i++) {
+        haystack[i] = i * 4 + rand() % 4;
+    }
+    for (size_t i = 0; i < needles_size; i++) {
+        needles[i] = rand() % (haystack_size * 4);
+    }
+
+    long cpus     = sysconf(_SC_NPROCESSORS_ONLN);
+    size_t errors = 0;
+    for (int sorted = 0; sorted <= 1; sorted++) {
+        if (sorted) {
+            qsort(needles, needles_size, sizeof(int), compare_ints);
+        }
+
+        double start = bench_now();
+        search_batch_serial(needles, needles_size, haystack, haystack_size, serial);
+        double serial_time = bench_now() - start;
+        printf("Batch of %zu %s needles over %zu elements (%ld CPUs): serial %.2f Mlookups/s\n", needles_size,
+               sorted ? "sorted" : "unsorted", haystack_size, cpus, needles_size / serial_time / 1e6);
+
+        for (unsigned int threads = 1; threads <= 64; threads *= 2) {
+            search_pool_t* pool = search_pool_new(threads);
+            if (pool == NULL) {
+                errors++;
+                break;
+            }
+
+            start = bench_now();
+            search_pool_batch(pool, needles, needles_size, haystack, haystack_size, results);
+            double elapsed = bench_now() - start;
+            search_pool_free(pool);
+
+            size_t mismatches = 0;
+            for (size_t i = 0; i < needles_size; i++) {
+                mismatches += results[i] != serial[i];
+            }
+            errors += mismatches;
+
+            printf("  %2u threads: %8.2f Mlookups/s - speedup %.2fx - mismatches: %zu\n", threads,
+                   needles_size / elapsed / 1e6, serial_time / elapsed, mismatches);
+        }
+    }
+
+    free(haystack);
+    free(needles);
+    free(serial);
+    free(results);
+    return errors != 0;
+}
+
+/**
+ * Run the bound searches on a haystack with more than 2^32 elements.
+ *
+ * The haystack is an anonymous mapping, only the pages holding the tail of
+ * non zero values and the ones probed by the searches are ever backed by
+ * memory, so this runs fine on machines with less memory than the haystack.
+ *
+ * Returns:
+ *   0 on success, 1 if the haystack could not be mapped or the results are wrong.
+ */
+int bench_huge_haystack() {
+    const size_t haystack_size = (5UL << 30) + 3;
+    const size_t tail          = 1024;
+    const size_t lookups       = 1 << 20;
+
+    int* haystack = mmap(NULL, haystack_size * sizeof(int), PROT_READ | PROT_WRITE,
+                         MAP_PRIVATE | MAP_ANONYMOUS | MAP_NORESERVE, -1, 0);
+    if (haystack == MAP_FAILED) {
+        printf("Failed to map a haystack with %zu elements, skipping\n", haystack_size);
+        return 0;
+    }
+
+    for (size_t i = 0; i < tail; i++) {
+        haystack[haystack_size - tail + i] = i + 1;
+    }
+
+    size_t errors         = 0;
+    search_range_t zeros  = search_equal_range(0, haystack, haystack_size);
+    errors               += zeros.first != 0 || zeros.last != haystack_size - tail;
+
+    double start = bench_now();
+    for (size_t i = 0; i < lookups; i++) {
+        int needle       = i % (tail + 1);
+        size_t expected  = needle ? haystack_size - tail + needle - 1 : 0;
+        errors          += search_lower_bound(needle, haystack, haystack_size) != expected;
+    }
+    double elapsed = bench_now() - start;
+
+    printf("Lower bound on %zu mapped elements: %.2f Mlookups/s - errors: %zu\n", haystack_size,
+           lookups / elapsed / 1e6, errors);
+
+    munmap(haystack, haystack_size * sizeof(int));
+    return errors != 0;
+}
+
+/**
+ * Run the benchmarks for the search strategies on uniform and skewed haystacks.
+ *
+ * Returns:
+ *   0 on success, 1 if memory could not be allocated.
+ */
+int run_benchmarks() {
+    const size_t sizes[]      = {1024, 1 << 22};
+    const size_t needles_size = 1 << 20;
+
+    int* needles  = malloc(needles_size * sizeof(int));
+    int* results  = malloc(needles_size * sizeof(int));
+    int* haystack = malloc(sizes[1] * sizeof(int));
+    if (needles == NULL || results == NULL || haystack == NULL) {
+        free(needles);
+        free(results);
+        free(haystack);
+        return 1;
+    }
+
+    for (size_t s = 0; s < sizeof(sizes) / sizeof(*sizes); s++) {
+        size_t haystack_size = sizes[s];
+
+        srand(42);
+        for (size_t i = 0; i < haystack_size; i++) {
+            haystack[i] = i * 16 + rand() % 16;
+        }
+        for (size_t i = 0; i < needles_size; i++) {
+            needles[i] = haystack[rand() % haystack_size] + (i & 1);
+        }
+        bench_strategies("Uniform", haystack, haystack_size, needles, results, needles_size);
+        bench_bounds(haystack, haystack_size, needles, needles_size);
+
+        for (size_t i = 0; i < haystack_size; i++) {
+            haystack[i] = rand() % 10 ? rand() % haystack_size : rand();
+        }
+        qsort(haystack, haystack_size, sizeof(int), compare_ints);
+        for (size_t i = 0; i < needles_size; i++) {
+            needles[i] = haystack[rand() % haystack_size] + (i & 1);
+        }
+        bench_strategies("Skewed", haystack, haystack_size, needles, results, needles_size);
+        bench_bounds(haystack, haystack_size, needles, needles_size);
+    }
+
+    free(needles);
+    free(results);
+    free(haystack);
+    return bench_index() || bench_filter() || bench_batch() || bench_huge_haystack();
+}
+
 int main(int argc, char* argv[]) {
+    if (argc > 1 && strcmp(argv[1], "bench") == 0) {
+        return run_benchmarks();
+    }
+
     int haystack[]       = {-28, -10, -4, 0, 5, 10, 20, 140, 1000};
     size_t haystack_size = sizeof(haystack) / sizeof(typeof(*haystack));
 
@@ -103,11 +1790,78 @@ int main(int argc, char* argv[]) {
     size_t test_cases_size = sizeof(test_cases) / sizeof(test_case);
 
     int failures = 0;
+    for (search_strategy_t strategy = TERNARY; strategy <= AUTO; strategy++) {
+        for (int i = 0; i < test_cases_size; i++) {
+            failures += execute_test(&test_cases[i], strategy);
+        }
+    }
+
+    const size_t hints[] = {1, 4, 8, 100};
+    size_t hints_size    = sizeof(hints) / sizeof(*hints);
+    for (int h = 0; h < hints_size; h++) {
+        for (int i = 0; i < test_cases_size; i++) {
+            failures += execute_hint_test(&test_cases[i], hints[h]);
+        }
+    }
+
+    const size_t block_sizes[] = {0, 1, 2, 4};
+    size_t block_sizes_size    = sizeof(block_sizes) / sizeof(*block_sizes);
+    for (int b = 0; b < block_sizes_size; b++) {
+        for (int i = 0; i < test_cases_size; i++) {
+            failures += execute_index_test(&test_cases[i], block_sizes[b]);
+        }
+    }
+
     for (int i = 0; i < test_cases_size; i++) {
-        failures += execute_test(&test_cases[i]);
+        failures += execute_filter_test(&test_cases[i]);
+    }
+
+    failures += execute_batch_test(test_cases, test_cases_size, haystack, haystack_size, 0);
+    failures += execute_batch_test(test_cases, test_cases_size, haystack, haystack_size, 1);
+    failures += execute_batch_test(test_cases, test_cases_size, NULL, haystack_size, 0);
+    failures += execute_batch_test(test_cases, test_cases_size, NULL, haystack_size, 1);
+    failures += execute_large_batch_test(0);
+    failures += execute_large_batch_test(1);
+
+    int duplicates[]       = {-3, 1, 1, 1, 4, 4, 9};
+    size_t duplicates_size = sizeof(duplicates) / sizeof(typeof(*duplicates));
+
+    bounds_test_case bounds_test_cases[] = {
+        {-3, 0, 1, duplicates, duplicates_size}, {-5, 0, 0, duplicates, duplicates_size},
+        {1, 1, 4, duplicates, duplicates_size},  {2, 4, 4, duplicates, duplicates_size},
+        {4, 4, 6, duplicates, duplicates_size},  {9, 6, 7, duplicates, duplicates_size},
+        {10, 7, 7, duplicates, duplicates_size}, {0, 7, 7, NULL, duplicates_size},
+        {4, 0, 0, duplicates, 0},                {4, 0, 1, duplicates + 4, 1},
+        {5, 1, 1, duplicates + 4, 1},            {3, 0, 0, duplicates + 4, 1},
+    };
+    size_t bounds_test_cases_size = sizeof(bounds_test_cases) / sizeof(bounds_test_case);
+
+    for (int i = 0; i < bounds_test_cases_size; i++) {
+        failures += execute_bounds_test(&bounds_test_cases[i]);
+    }
+
+    // Only evenly spread haystacks big enough for sampling to pay off get interpolated.
+    int uniform[8192];
+    int skewed[8192];
+    for (int i = 0; i < 8192; i++) {
+        uniform[i] = i * 3 + i % 2;
+        skewed[i]  = i * i;
+    }
+
+    strategy_test_case strategy_test_cases[] = {
+        {uniform, 8192, INTERPOLATION}, {uniform, 1000, INTERPOLATION_SEQUENTIAL},
+        {uniform, 32, BINARY},          {skewed, 8192, BINARY},
+        {duplicates, 0, BINARY},        {NULL, 8192, BINARY},
+    };
+    size_t strategy_test_cases_size = sizeof(strategy_test_cases) / sizeof(strategy_test_case);
+
+    for (int i = 0; i < strategy_test_cases_size; i++) {
+        failures += execute_strategy_test(&strategy_test_cases[i]);
     }
 
-    printf("%d out of %zu tests failed\n", failures, test_cases_size);
+    printf("%d out of %zu tests failed\n", failures,
+           test_cases_size * (AUTO + 2 + hints_size + block_sizes_size) + 6 + bounds_test_cases_size +
+               strategy_test_cases_size);
 
     return failures;
 }